@@ -1,7 +1,12 @@
-﻿#include <iostream>
+﻿#include <algorithm>
+#include <cmath>
+#include <iostream>
 #include <benchmark/benchmark.h>
 #include "tweann.h"
 #include "neuron.h"
+#include "simd_kernels.h"
+#include "native_net.h"
+#include "frozen_net.h"
 #include "tcp_stream.h"
 #include "json_routines.h"
 
@@ -63,9 +68,7 @@ static void neuron_construct(benchmark::State& state)
 
 BENCHMARK_DEFINE_F(net_complex, neuron_rep_get)(benchmark::State& state)
 {
-	std::vector<size_t> ids;
-	for (auto i: net->nr.neurons)
-		ids.push_back(i.c->id);
+	std::vector<size_t> ids(net->nr.ids().begin(), net->nr.ids().end());
 
 	const auto begin = ids.begin();
 	const auto end = ids.end();
@@ -74,7 +77,7 @@ BENCHMARK_DEFINE_F(net_complex, neuron_rep_get)(benchmark::State& state)
 	{
 		if (++cur == end)
 			cur = begin;
-		benchmark::DoNotOptimize(net->nr.get(*cur));
+		benchmark::DoNotOptimize(net->nr.slot(*cur));
 	}
 	state.SetItemsProcessed(state.iterations());
 }
@@ -82,7 +85,7 @@ BENCHMARK_DEFINE_F(net_complex, neuron_rep_get)(benchmark::State& state)
 BENCHMARK_DEFINE_F(net_complex, link_rep_get)(benchmark::State& state)
 {
 	std::vector<size_t> ids;
-	for (auto i : net->lr.links)
+	for (auto i : net->lr.links())
 		ids.push_back(i.id);
 
 	const auto begin = ids.begin();
@@ -92,7 +95,7 @@ BENCHMARK_DEFINE_F(net_complex, link_rep_get)(benchmark::State& state)
 	{
 		if (++cur == end)
 			cur = begin;
-		benchmark::DoNotOptimize(net->nr.get(*cur));
+		benchmark::DoNotOptimize(net->lr.get(*cur));
 	}
 	state.SetItemsProcessed(state.iterations());
 }
@@ -110,6 +113,94 @@ BENCHMARK_DEFINE_F(net_complex, tweann_calc)(benchmark::State& state)
 	state.SetBytesProcessed(state.iterations()*(13 * sizeof(double)));
 }
 
+BENCHMARK_DEFINE_F(net_complex, tweann_calc_into)(benchmark::State& state)
+{
+	net->update_plan();
+	std::vector<double> input(13, 1);
+	std::vector<double> output(net->plan.outputs.size());
+
+	while (state.KeepRunning())
+	{
+		net->calc_into(input.data(), input.size(), output.data(), output.size());
+		benchmark::DoNotOptimize(output.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations()*(13 * sizeof(double)));
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_calc_event_driven)(benchmark::State& state)
+{
+	net->event_driven = state.range_x() != 0;
+	net->update_plan();
+	std::vector<double> input(13, 0);
+	input[0] = 1;
+	std::vector<double> output(net->plan.outputs.size());
+
+	while (state.KeepRunning())
+	{
+		net->calc_into(input.data(), input.size(), output.data(), output.size());
+		benchmark::DoNotOptimize(output.data());
+	}
+	net->event_driven = false;
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations()*(13 * sizeof(double)));
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_calc_pruned)(benchmark::State& state)
+{
+	net->prune_unobservable = state.range_x() != 0;
+	net->update_plan();
+	std::vector<double> input(13, 1);
+	std::vector<double> output(net->plan.outputs.size());
+
+	while (state.KeepRunning())
+	{
+		net->calc_into(input.data(), input.size(), output.data(), output.size());
+		benchmark::DoNotOptimize(output.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations()*(13 * sizeof(double)));
+
+	std::ostringstream label;
+	label << "pruned " << net->plan.pruned_neurons << " neurons, " << net->plan.pruned_links
+		<< " links";
+	state.SetLabel(label.str());
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_calc_ticks)(benchmark::State& state)
+{
+	const size_t ticks = state.range_x();
+	net->update_plan();
+	std::vector<double> input(13, 1);
+	std::vector<double> output(net->plan.outputs.size());
+
+	while (state.KeepRunning())
+	{
+		net->calc_ticks_into(input.data(), input.size(), output.data(), output.size(), ticks, -1);
+		benchmark::DoNotOptimize(output.data());
+	}
+	state.SetItemsProcessed(state.iterations() * ticks);
+	state.SetBytesProcessed(state.iterations()*(13 * sizeof(double)));
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_calc_batch)(benchmark::State& state)
+{
+	const size_t count = state.range_x();
+	net->update_plan();
+	batch_state batch;
+	batch.reset(*net, count);
+	std::vector<double> input(count * 13, 1);
+	std::vector<double> output(count * net->plan.outputs.size());
+
+	while (state.KeepRunning())
+	{
+		net->calc_batch(batch, input.data(), output.data());
+		benchmark::DoNotOptimize(output.data());
+	}
+	state.SetItemsProcessed(state.iterations() * count);
+	state.SetBytesProcessed(state.iterations() * count * (13 * sizeof(double)));
+}
+
 BENCHMARK_DEFINE_F(net_simple, tweann_calc)(benchmark::State& state)
 {
 	net_task input;
@@ -123,6 +214,195 @@ BENCHMARK_DEFINE_F(net_simple, tweann_calc)(benchmark::State& state)
 	state.SetBytesProcessed(state.iterations()*(13 * sizeof(double)));
 }
 
+BENCHMARK_DEFINE_F(net_complex, link_rep_free)(benchmark::State& state)
+{
+	std::vector< std::uint64_t > ids;
+	for (auto& i : net->lr.links())
+		ids.push_back(i.id);
+
+	while (state.KeepRunning())
+	{
+		state.PauseTiming();
+		link_rep lr(net->lr);
+		state.ResumeTiming();
+		for (auto id : ids)
+			lr.free(id);
+		lr.compact();
+	}
+	state.SetItemsProcessed(state.iterations() * ids.size());
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_copy)(benchmark::State& state)
+{
+	while (state.KeepRunning())
+	{
+		tweann copy(*net);
+		benchmark::DoNotOptimize(copy);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_copy_set_weight)(benchmark::State& state)
+{
+	while (state.KeepRunning())
+	{
+		tweann copy(*net);
+		copy.lr.set_weight(0, 0.5);
+		benchmark::DoNotOptimize(copy);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+/* A structural mutation on a copy detaches the topology blocks, indices included */
+BENCHMARK_DEFINE_F(net_complex, tweann_copy_create_link)(benchmark::State& state)
+{
+	const std::uint64_t from = net->nr.ids().front();
+	const std::uint64_t to = net->nr.ids().back();
+	while (state.KeepRunning())
+	{
+		tweann copy(*net);
+		copy.lr.create(from, to, 0.5);
+		benchmark::DoNotOptimize(copy);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+static void calc_with_simd(benchmark::State& state, tweann* net)
+{
+	const simd_level old = get_simd_level();
+	if (set_simd_level(simd_level(state.range_x())) != simd_level(state.range_x()))
+	{
+		state.SkipWithError("SIMD level isn't supported by this CPU");
+		return;
+	}
+
+	net_task input;
+	input.resize(13, 1);
+
+	while (state.KeepRunning())
+	{
+		benchmark::DoNotOptimize(net->calc(input));
+	}
+	state.SetItemsProcessed(state.iterations());
+	set_simd_level(old);
+}
+
+BENCHMARK_DEFINE_F(net_simple, tweann_calc_simd)(benchmark::State& state)
+{
+	calc_with_simd(state, net);
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_calc_simd)(benchmark::State& state)
+{
+	calc_with_simd(state, net);
+}
+
+/* Times T against the same network and labels the run with the largest output difference
+ * from the double path over drift_ticks ticks of the same input. */
+template< typename T >
+static void calc_with_precision(benchmark::State& state, tweann* net)
+{
+	const size_t count = state.range_x();
+	const size_t drift_ticks = 1000;
+	net->update_plan();
+	const size_t n_out = net->plan.outputs.size();
+
+	basic_batch_state< T > batch;
+	batch.reset(*net, count);
+	std::vector< T > input(count * 13, 1);
+	std::vector< T > output(count * n_out);
+
+	while (state.KeepRunning())
+	{
+		net->calc_batch(batch, input.data(), output.data());
+		benchmark::DoNotOptimize(output.data());
+	}
+	state.SetItemsProcessed(state.iterations() * count);
+	state.SetBytesProcessed(state.iterations() * count * (13 * sizeof(T)));
+
+	batch_state ref;
+	ref.reset(*net, 1);
+	batch.reset(*net, 1);
+	std::vector< double > ref_input(13, 1);
+	std::vector< double > ref_output(n_out);
+	double drift = 0;
+	for (size_t t = 0; t < drift_ticks; t++)
+	{
+		net->calc_batch(ref, ref_input.data(), ref_output.data());
+		net->calc_batch(batch, input.data(), output.data());
+		for (size_t i = 0; i < n_out; i++)
+		{
+			drift = std::max(drift, std::fabs(ref_output[i] - static_cast< double >(output[i])));
+		}
+	}
+	state.SetLabel("drift " + std::to_string(drift));
+}
+
+static void calc_native(benchmark::State& state, tweann* net)
+{
+	native_net native(*net);
+	std::vector<double> input(13, 1);
+	std::vector<double> output(net->plan.outputs.size());
+
+	while (state.KeepRunning())
+	{
+		native.calc_into(input.data(), input.size(), output.data(), output.size());
+		benchmark::DoNotOptimize(output.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations()*(13 * sizeof(double)));
+	state.SetLabel(native.native() ? "native" : "interpreted");
+}
+
+BENCHMARK_DEFINE_F(net_simple, tweann_calc_native)(benchmark::State& state)
+{
+	calc_native(state, net);
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_calc_native)(benchmark::State& state)
+{
+	calc_native(state, net);
+}
+
+BENCHMARK_DEFINE_F(net_complex, frozen_net_calc)(benchmark::State& state)
+{
+	const size_t count = state.range_x();
+	frozen_net frozen(*net);
+	std::vector< frozen_state > states(count);
+	for (auto& st : states)
+	{
+		st.reset(frozen);
+	}
+
+	std::vector<double> input(13, 1);
+	std::vector<double> output(frozen.outputs.size());
+
+	while (state.KeepRunning())
+	{
+		for (auto& st : states)
+		{
+			frozen.calc(st, input.data(), output.data());
+		}
+		benchmark::DoNotOptimize(output.data());
+	}
+	state.SetItemsProcessed(state.iterations() * count);
+	state.SetBytesProcessed(state.iterations() * count * (13 * sizeof(double)));
+
+	std::ostringstream label;
+	label << frozen.state_bytes() << " bytes/instance";
+	state.SetLabel(label.str());
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_calc_double)(benchmark::State& state)
+{
+	calc_with_precision< double >(state, net);
+}
+
+BENCHMARK_DEFINE_F(net_complex, tweann_calc_float)(benchmark::State& state)
+{
+	calc_with_precision< float >(state, net);
+}
+
 BENCHMARK_DEFINE_F(net_complex, tweann_reset)(benchmark::State& state)
 {
 	while (state.KeepRunning())
@@ -132,6 +412,25 @@ BENCHMARK_DEFINE_F(net_complex, tweann_reset)(benchmark::State& state)
 	state.SetItemsProcessed(state.iterations());
 }
 
+BENCHMARK_DEFINE_F(net_complex, tweann_reset_after_calc)(benchmark::State& state)
+{
+	net->event_driven = state.range_x() != 0;
+	net->update_plan();
+	std::vector<double> input(13, 0);
+	input[0] = 1;
+	std::vector<double> output(net->plan.outputs.size());
+
+	while (state.KeepRunning())
+	{
+		state.PauseTiming();
+		net->calc_into(input.data(), input.size(), output.data(), output.size());
+		state.ResumeTiming();
+		net->reset();
+	}
+	net->event_driven = false;
+	state.SetItemsProcessed(state.iterations());
+}
+
 static void handle_json_message_check(benchmark::State& state)
 {
 	const size_t udp_buffer = 307200;
@@ -228,8 +527,25 @@ BENCHMARK(tweann_construct)->ArgPair(3, 1)->ArgPair(10, 10)->ArgPair(100, 100);
 BENCHMARK_REGISTER_F(net_complex, neuron_rep_get);
 BENCHMARK_REGISTER_F(net_complex, link_rep_get);
 BENCHMARK_REGISTER_F(net_complex, tweann_calc);
+BENCHMARK_REGISTER_F(net_complex, tweann_calc_into);
+BENCHMARK_REGISTER_F(net_complex, tweann_calc_event_driven)->Arg(0)->Arg(1); // dense, sparse
+BENCHMARK_REGISTER_F(net_complex, tweann_calc_pruned)->Arg(0)->Arg(1);
+BENCHMARK_REGISTER_F(net_complex, tweann_calc_ticks)->Arg(1)->Arg(4);
+BENCHMARK_REGISTER_F(net_complex, tweann_calc_batch)->Arg(1)->Arg(16);
 BENCHMARK_REGISTER_F(net_simple, tweann_calc);
+BENCHMARK_REGISTER_F(net_simple, tweann_calc_native);
+BENCHMARK_REGISTER_F(net_complex, tweann_calc_native);
+BENCHMARK_REGISTER_F(net_complex, frozen_net_calc)->Arg(1)->Arg(1000);
+BENCHMARK_REGISTER_F(net_simple, tweann_calc_simd)->Arg(0)->Arg(1)->Arg(2); // scalar, sse2, avx2
+BENCHMARK_REGISTER_F(net_complex, tweann_calc_simd)->Arg(0)->Arg(1)->Arg(2);
+BENCHMARK_REGISTER_F(net_complex, tweann_calc_double)->Arg(1)->Arg(16);
+BENCHMARK_REGISTER_F(net_complex, tweann_calc_float)->Arg(1)->Arg(16);
+BENCHMARK_REGISTER_F(net_complex, link_rep_free);
+BENCHMARK_REGISTER_F(net_complex, tweann_copy);
+BENCHMARK_REGISTER_F(net_complex, tweann_copy_set_weight);
+BENCHMARK_REGISTER_F(net_complex, tweann_copy_create_link);
 BENCHMARK_REGISTER_F(net_complex, tweann_reset);
+BENCHMARK_REGISTER_F(net_complex, tweann_reset_after_calc)->Arg(0)->Arg(1); // dense, sparse
 BENCHMARK(handle_json_message_check);
 BENCHMARK(load_net_from_file)->Arg(1)->Arg(2);
 BENCHMARK(load_net_from_string)->Arg(1)->Arg(2);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+
+namespace nlab {
+
+/* Value of type T shared between copies until one of them writes to it.
+ * Reads go through operator-> / operator*, writes through write(), which detaches the
+ * calling copy first if the value is shared. */
+template< typename T >
+class cow_ptr
+{
+public:
+	cow_ptr() : p_(std::make_shared< T >()) { }
+
+	const T& operator*() const
+	{
+		return *p_;
+	}
+
+	const T* operator->() const
+	{
+		return p_.get();
+	}
+
+	T& write()
+	{
+		if (p_.use_count() > 1)
+		{
+			p_ = std::make_shared< T >(*p_);
+		}
+
+		return *p_;
+	}
+
+	bool shared() const
+	{
+		return p_.use_count() > 1;
+	}
+
+private:
+	std::shared_ptr< T > p_;
+};
+
+} // namespace nlab
@@ -24,6 +24,8 @@ struct e_start_info
 	size_t count{0};
 	size_t incount{0};
 	size_t outcount{0};
+	size_t ticks{1}; // network ticks per env step
+	double settle_eps{0}; // > 0: stop earlier once outputs move by at most settle_eps
 };
 
 struct n_start_info
@@ -61,6 +63,8 @@ struct env_state
 	size_t count{0};
 	size_t incount{0};
 	size_t outcount{0};
+	size_t ticks{1};
+	double settle_eps{0};
 	size_t round_seed{0};
 };
 
@@ -0,0 +1,711 @@
+#include "eval_plan.h"
+#include "neuron.h"
+#include "simd_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+using namespace nlab;
+
+namespace {
+
+/* */
+template< typename T >
+const T* weights(const eval_plan& p);
+
+template< >
+const double* weights< double >(const eval_plan& p)
+{
+	return p.out_weights.data();
+}
+
+template< >
+const float* weights< float >(const eval_plan& p)
+{
+	return p.out_weights_f.data();
+}
+
+/* */
+template< typename T >
+T get_ei(const eval_plan& p, size_t n, T* out_e)
+{
+	T s = 0;
+	size_t end = p.in_offsets[n + 1];
+	for (size_t i = p.in_offsets[n]; i < end; i++)
+	{
+		size_t j = p.in_links[i];
+		T k = out_e[j];
+		out_e[j] = 0;
+		s += k;
+	}
+
+	return s;
+}
+
+/* */
+template< typename T >
+void set_eo(const eval_plan& p, const basic_simd_kernels< T >& k, size_t n, T eo, T* in_e)
+{
+	size_t begin = p.out_offsets[n];
+	k.scatter(in_e, p.out_links.data() + begin, weights< T >(p) + begin,
+		p.out_offsets[n + 1] - begin, eo);
+}
+
+/* One neuron tick. Type is a compile-time constant, so every instantiation is a straight
+ * sequence; threshold tests are selects. set_eo(0) is still issued when a neuron doesn't
+ * fire, exactly as before, so the results don't change. */
+template< neuron_type Type, typename T >
+inline void calc_neuron(const eval_plan& p, const basic_simd_kernels< T >& k, size_t i, T ea, T& e,
+	T* in_e, T* out_e)
+{
+	const T zero = 0;
+	switch (Type)
+	{
+		case neuron_type::input:
+			set_eo(p, k, i, e, in_e);
+			e = 0;
+			break;
+
+		case neuron_type::output:
+			e = get_ei(p, i, out_e);
+			break;
+
+		case neuron_type::blank:
+			set_eo(p, k, i, e, in_e);
+			e = get_ei(p, i, out_e);
+			break;
+
+		case neuron_type::activ:
+		{
+			const bool fire = !(e < ea);
+			set_eo(p, k, i, fire ? e : zero, in_e);
+			e = fire ? zero : e;
+			e += get_ei(p, i, out_e);
+			break;
+		}
+
+		case neuron_type::limit:
+		{
+			const bool fire = !(e < ea);
+			set_eo(p, k, i, fire ? ea : zero, in_e);
+			e = fire ? e - ea : e;
+			e += get_ei(p, i, out_e);
+			break;
+		}
+
+		case neuron_type::binary:
+			set_eo(p, k, i, (e < ea) ? zero : ea, in_e);
+			e = get_ei(p, i, out_e);
+			break;
+
+		case neuron_type::gen:
+			set_eo(p, k, i, (e < ea) ? ea : zero, in_e);
+			e = get_ei(p, i, out_e);
+			break;
+
+		case neuron_type::invert:
+			set_eo(p, k, i, e, in_e);
+			e = T(-1) * get_ei(p, i, out_e);
+			break;
+	}
+}
+
+/* */
+template< neuron_type Type, typename T >
+void calc_bucket(const eval_plan& p, const basic_simd_kernels< T >& k, const double* ea, T* energy,
+	T* in_e, T* out_e)
+{
+	size_t end = p.bucket_offsets[Type + 1];
+	for (size_t b = p.bucket_offsets[Type]; b < end; b++)
+	{
+		size_t i = p.buckets[b];
+		calc_neuron< Type >(p, k, i, static_cast< T >(ea[i]), energy[i], in_e, out_e);
+	}
+}
+
+/* calc_neuron for a type known only at run time */
+template< typename T >
+inline void calc_typed(const eval_plan& p, const basic_simd_kernels< T >& k, neuron_type type,
+	size_t i, T a, T& e, T* in_e, T* out_e)
+{
+	switch (type)
+	{
+		case neuron_type::input:
+			calc_neuron< neuron_type::input >(p, k, i, a, e, in_e, out_e);
+			break;
+		case neuron_type::output:
+			calc_neuron< neuron_type::output >(p, k, i, a, e, in_e, out_e);
+			break;
+		case neuron_type::blank:
+			calc_neuron< neuron_type::blank >(p, k, i, a, e, in_e, out_e);
+			break;
+		case neuron_type::activ:
+			calc_neuron< neuron_type::activ >(p, k, i, a, e, in_e, out_e);
+			break;
+		case neuron_type::limit:
+			calc_neuron< neuron_type::limit >(p, k, i, a, e, in_e, out_e);
+			break;
+		case neuron_type::binary:
+			calc_neuron< neuron_type::binary >(p, k, i, a, e, in_e, out_e);
+			break;
+		case neuron_type::gen:
+			calc_neuron< neuron_type::gen >(p, k, i, a, e, in_e, out_e);
+			break;
+		case neuron_type::invert:
+			calc_neuron< neuron_type::invert >(p, k, i, a, e, in_e, out_e);
+			break;
+	}
+}
+
+/* With e == 0 limit fires ea and binary emits ea unless ea >= 0 (NaN included), gen emits
+ * ea when ea > 0; every other type is a no-op without energy. */
+bool is_spontaneous(neuron_type type, double ea)
+{
+	bool negative = !(ea >= 0);
+	return (type == neuron_type::gen && ea > 0) || (type == neuron_type::limit && negative) ||
+		(type == neuron_type::binary && negative);
+}
+
+/* */
+void queue(eval_frontier& f, slot_index i)
+{
+	if (!f.queued[i])
+	{
+		f.queued[i] = 1;
+		f.next.push_back(i);
+	}
+}
+
+/* */
+void queue_readers(const eval_plan& p, eval_frontier& f, size_t j)
+{
+	for (size_t r = p.reader_offsets[j]; r < p.reader_offsets[j + 1]; r++)
+	{
+		queue(f, p.readers[r]);
+	}
+}
+
+} // namespace
+
+/* */
+void eval_plan::compile(const neuron_rep& nr, const link_rep& lr, bool prune_unobservable)
+{
+	const std::vector< neuron_type >& types = nr.types();
+	const std::vector< double >& weights = lr.weights();
+	const std::vector< double >& ea = nr.ea();
+	size_t sz = nr.size();
+	if (sz >= std::numeric_limits< slot_index >::max() ||
+		lr.size() >= std::numeric_limits< slot_index >::max())
+	{
+		throw std::runtime_error("Network is too large for 32-bit slot indices");
+	}
+
+	in_offsets.assign(1, 0);
+	out_offsets.assign(1, 0);
+	in_offsets.reserve(sz + 1);
+	out_offsets.reserve(sz + 1);
+	in_links.clear();
+	out_links.clear();
+	out_weights.clear();
+	out_weights_f.clear();
+	inputs.clear();
+	outputs.clear();
+
+	for (size_t i = 0; i < sz; i++)
+	{
+		for (auto id : nr.in(i))
+		{
+			size_t j = lr.slot(id);
+			if (j != link_rep::npos)
+			{
+				in_links.push_back(static_cast< slot_index >(j));
+			}
+		}
+
+		double s1 = 0;
+		size_t out_begin = out_links.size();
+		for (auto id : nr.out(i))
+		{
+			size_t j = lr.slot(id);
+			if (j != link_rep::npos)
+			{
+				out_links.push_back(static_cast< slot_index >(j));
+				s1 += std::fabs(weights[j]);
+			}
+		}
+
+		double lamb = 0;
+		if (s1 != 0)
+		{
+			lamb = 1.f / s1;
+		}
+
+		for (size_t k = out_begin; k < out_links.size(); k++)
+		{
+			out_weights.push_back(weights[out_links[k]] * lamb);
+			out_weights_f.push_back(static_cast< float >(out_weights.back()));
+		}
+
+		in_offsets.push_back(static_cast< slot_index >(in_links.size()));
+		out_offsets.push_back(static_cast< slot_index >(out_links.size()));
+
+		if (!nr.alive(i))
+		{
+			continue;
+		}
+
+		if (types[i] == neuron_type::input)
+		{
+			inputs.push_back(static_cast< slot_index >(i));
+		}
+		else if (types[i] == neuron_type::output)
+		{
+			outputs.push_back(static_cast< slot_index >(i));
+		}
+	}
+
+	neuron_count = sz;
+	link_count = lr.size();
+	unobservable_pruned = prune_unobservable;
+
+	std::vector< char > reads(sz, 0);
+	for (size_t i = 0; i < sz; i++)
+	{
+		reads[i] = nr.alive(i) && types[i] != neuron_type::input;
+	}
+
+	index_readers(reads);
+	prune(nr, lr, prune_unobservable);
+
+	// Neurons only read links through get_ei, which consumes out_e. If two neurons read the same
+	// link the first one wins, so slot order has to be kept; otherwise any order gives the
+	// same result and neurons are grouped by type.
+	const size_t none = static_cast< size_t >(-1);
+	std::vector< size_t > reader(lr.size(), none);
+	ordered = false;
+	for (size_t i = 0; i < sz && !ordered; i++)
+	{
+		for (size_t b = in_offsets[i]; b < in_offsets[i + 1]; b++)
+		{
+			size_t j = in_links[b];
+			if (reader[j] != none && reader[j] != i)
+			{
+				ordered = true;
+			}
+
+			reader[j] = i;
+		}
+	}
+
+	bucket_offsets.assign(neuron_type_count + 1, 0);
+	for (size_t i = 0; i < sz; i++)
+	{
+		if (evaluated[i] && types[i] < neuron_type_count)
+		{
+			bucket_offsets[types[i] + 1]++;
+		}
+	}
+
+	for (size_t t = 0; t < neuron_type_count; t++)
+	{
+		bucket_offsets[t + 1] += bucket_offsets[t];
+	}
+
+	buckets.resize(bucket_offsets.back());
+	std::vector< slot_index > fill(bucket_offsets.begin(), bucket_offsets.end() - 1);
+	for (size_t i = 0; i < sz; i++)
+	{
+		if (evaluated[i] && types[i] < neuron_type_count)
+		{
+			buckets[fill[types[i]]++] = static_cast< slot_index >(i);
+		}
+	}
+
+	for (size_t i = 0; i < sz; i++)
+	{
+		reads[i] = evaluated[i] && types[i] != neuron_type::input;
+	}
+
+	index_readers(reads);
+
+	spontaneous.clear();
+	for (size_t i = 0; i < sz; i++)
+	{
+		if (evaluated[i] && is_spontaneous(types[i], ea[i]))
+		{
+			spontaneous.push_back(static_cast< slot_index >(i));
+		}
+	}
+
+	compiled_ = true;
+	nr_revision_ = nr.revision;
+	lr_revision_ = lr.revision;
+}
+
+/* Energy only enters through the inputs, spontaneous neurons and the state the plan is
+ * compiled on (setting energy afterwards bumps the revision), so a neuron none of them can
+ * reach stays at rest, which is a no-op, for as long as the plan is valid. That keeps the
+ * state exact and is always done.
+ * A neuron that can't pass energy on to an output doesn't change the outputs either, but its
+ * own state stops evolving while it is skipped, so that is only done on request. It is still
+ * evaluated if it reads a link an observable neuron reads, as it may consume the energy first.
+ * Links of skipped neurons are dropped from the CSR lists, out_links keep their normalized
+ * weights. */
+void eval_plan::prune(const neuron_rep& nr, const link_rep& lr, bool prune_unobservable)
+{
+	const std::vector< neuron_type >& types = nr.types();
+	const std::vector< double >& ea = nr.ea();
+	const size_t none = static_cast< size_t >(-1);
+	const size_t sz = neuron_count;
+
+	std::vector< size_t > writer(link_count, none);
+	for (size_t i = 0; i < sz; i++)
+	{
+		for (size_t b = out_offsets[i]; b < out_offsets[i + 1]; b++)
+		{
+			if (nr.alive(i) && types[i] != neuron_type::output)
+			{
+				writer[out_links[b]] = i;
+			}
+		}
+	}
+
+	std::vector< char > reached(sz, 0);
+	std::vector< size_t > stack;
+	for (size_t i = 0; i < sz; i++)
+	{
+		if (nr.alive(i) && (types[i] == neuron_type::input || is_spontaneous(types[i], ea[i]) ||
+			nr.e()[i] != 0))
+		{
+			reached[i] = 1;
+			stack.push_back(i);
+		}
+	}
+
+	for (size_t j = 0; j < link_count; j++)
+	{
+		for (size_t r = reader_offsets[j]; r < reader_offsets[j + 1]; r++)
+		{
+			if ((lr.in_e()[j] != 0 || lr.out_e()[j] != 0) && !reached[readers[r]])
+			{
+				reached[readers[r]] = 1;
+				stack.push_back(readers[r]);
+			}
+		}
+	}
+
+	while (!stack.empty())
+	{
+		size_t i = stack.back();
+		stack.pop_back();
+		for (size_t b = out_offsets[i]; b < out_offsets[i + 1] && types[i] != neuron_type::output;
+			b++)
+		{
+			size_t j = out_links[b];
+			for (size_t r = reader_offsets[j]; r < reader_offsets[j + 1]; r++)
+			{
+				if (!reached[readers[r]])
+				{
+					reached[readers[r]] = 1;
+					stack.push_back(readers[r]);
+				}
+			}
+		}
+	}
+
+	std::vector< char > observed(sz, !prune_unobservable);
+	if (prune_unobservable)
+	{
+		for (auto i : outputs)
+		{
+			observed[i] = 1;
+			stack.push_back(i);
+		}
+
+		while (!stack.empty())
+		{
+			size_t i = stack.back();
+			stack.pop_back();
+			for (size_t b = in_offsets[i]; b < in_offsets[i + 1] && types[i] != neuron_type::input;
+				b++)
+			{
+				size_t w = writer[in_links[b]];
+				if (w != none && !observed[w])
+				{
+					observed[w] = 1;
+					stack.push_back(w);
+				}
+			}
+		}
+
+		std::vector< char > consumes(sz, 0);
+		for (size_t j = 0; j < link_count; j++)
+		{
+			bool shared = false;
+			for (size_t r = reader_offsets[j]; r < reader_offsets[j + 1]; r++)
+			{
+				shared = shared || observed[readers[r]];
+			}
+
+			for (size_t r = reader_offsets[j]; r < reader_offsets[j + 1] && shared; r++)
+			{
+				consumes[readers[r]] = 1;
+			}
+		}
+
+		for (size_t i = 0; i < sz; i++)
+		{
+			observed[i] = observed[i] || consumes[i];
+		}
+	}
+
+	evaluated.assign(sz, 0);
+	skipped.clear();
+	for (size_t i = 0; i < sz; i++)
+	{
+		evaluated[i] = nr.alive(i) && reached[i] && observed[i];
+		if (nr.alive(i) && !evaluated[i])
+		{
+			skipped.push_back(static_cast< slot_index >(i));
+		}
+	}
+
+	pruned_neurons = skipped.size();
+
+	// in links of evaluated neurons stay, energy from before the compile may still be on them;
+	// out links are dropped only if no evaluated neuron reads them
+	std::vector< char > kept(link_count, 0);
+	std::vector< char > read(link_count, 0);
+	for (size_t j = 0; j < link_count; j++)
+	{
+		for (size_t r = reader_offsets[j]; r < reader_offsets[j + 1]; r++)
+		{
+			read[j] = read[j] || evaluated[readers[r]];
+		}
+	}
+
+	size_t in_end = 0;
+	size_t out_end = 0;
+	size_t in_begin = 0;
+	size_t out_begin = 0;
+	for (size_t i = 0; i < sz; i++)
+	{
+		for (size_t b = in_begin; b < in_offsets[i + 1] && evaluated[i]; b++)
+		{
+			kept[in_links[b]] = 1;
+			in_links[in_end++] = in_links[b];
+		}
+
+		for (size_t b = out_begin; b < out_offsets[i + 1] && evaluated[i]; b++)
+		{
+			if (read[out_links[b]] || !prune_unobservable)
+			{
+				kept[out_links[b]] = 1;
+				out_links[out_end] = out_links[b];
+				out_weights[out_end] = out_weights[b];
+				out_weights_f[out_end++] = out_weights_f[b];
+			}
+		}
+
+		in_begin = in_offsets[i + 1];
+		out_begin = out_offsets[i + 1];
+		in_offsets[i + 1] = static_cast< slot_index >(in_end);
+		out_offsets[i + 1] = static_cast< slot_index >(out_end);
+	}
+
+	in_links.resize(in_end);
+	out_links.resize(out_end);
+	out_weights.resize(out_end);
+	out_weights_f.resize(out_end);
+
+	idle_links.clear();
+	for (size_t j = 0; j < link_count; j++)
+	{
+		if (lr.alive(j) && !kept[j])
+		{
+			idle_links.push_back(static_cast< slot_index >(j));
+		}
+	}
+
+	pruned_links = idle_links.size();
+}
+
+/* readers of every link, taken from the neurons flagged in reads */
+void eval_plan::index_readers(const std::vector< char >& reads)
+{
+	reader_offsets.assign(link_count + 1, 0);
+	for (size_t i = 0; i < neuron_count; i++)
+	{
+		for (size_t b = in_offsets[i]; b < in_offsets[i + 1] && reads[i]; b++)
+		{
+			reader_offsets[in_links[b] + 1]++;
+		}
+	}
+
+	for (size_t j = 0; j < link_count; j++)
+	{
+		reader_offsets[j + 1] += reader_offsets[j];
+	}
+
+	readers.resize(reader_offsets.back());
+	std::vector< slot_index > fill(reader_offsets.begin(), reader_offsets.end() - 1);
+	for (size_t i = 0; i < neuron_count; i++)
+	{
+		for (size_t b = in_offsets[i]; b < in_offsets[i + 1] && reads[i]; b++)
+		{
+			readers[fill[in_links[b]]++] = static_cast< slot_index >(i);
+		}
+	}
+}
+
+/* */
+bool eval_plan::is_valid(const neuron_rep& nr, const link_rep& lr) const
+{
+	return compiled_ && nr_revision_ == nr.revision && lr_revision_ == lr.revision;
+}
+
+/* */
+template< typename T >
+void eval_plan::run(const neuron_rep& nr, T* energy, T* in_e, T* out_e) const
+{
+	const basic_simd_kernels< T >& k = get_simd_kernels< T >();
+	const double* ea = nr.ea().data();
+	const std::vector< neuron_type >& types = nr.types();
+
+	if (ordered)
+	{
+		for (size_t i = 0; i < neuron_count; i++)
+		{
+			if (!evaluated[i])
+			{
+				continue;
+			}
+
+			calc_typed(*this, k, types[i], i, static_cast< T >(ea[i]), energy[i], in_e, out_e);
+		}
+	}
+	else
+	{
+		calc_bucket< neuron_type::input >(*this, k, ea, energy, in_e, out_e);
+		calc_bucket< neuron_type::output >(*this, k, ea, energy, in_e, out_e);
+		calc_bucket< neuron_type::blank >(*this, k, ea, energy, in_e, out_e);
+		calc_bucket< neuron_type::activ >(*this, k, ea, energy, in_e, out_e);
+		calc_bucket< neuron_type::limit >(*this, k, ea, energy, in_e, out_e);
+		calc_bucket< neuron_type::binary >(*this, k, ea, energy, in_e, out_e);
+		calc_bucket< neuron_type::gen >(*this, k, ea, energy, in_e, out_e);
+		calc_bucket< neuron_type::invert >(*this, k, ea, energy, in_e, out_e);
+	}
+
+	k.shift(in_e, out_e, link_count);
+}
+
+/* A link only carries energy into the next tick if its source scattered into it, and a neuron
+ * only changes the state if it has energy, incoming energy or is spontaneous, so the next
+ * frontier is collected while the current one runs. Energies of exactly zero are skipped: adding
+ * a zero product never changes a link's energy. */
+void eval_plan::run_sparse(const neuron_rep& nr, eval_frontier& f, double* energy, double* in_e,
+	double* out_e) const
+{
+	const simd_kernels& k = get_simd_kernels< double >();
+	const double* ea = nr.ea().data();
+	const std::vector< neuron_type >& types = nr.types();
+
+	if (!f.valid || f.queued.size() != neuron_count || f.pending.size() != link_count)
+	{
+		f.next.clear();
+		f.links.clear();
+		f.next_links.clear();
+		f.queued.assign(neuron_count, 0);
+		f.pending.assign(link_count, 0);
+		for (size_t i = 0; i < neuron_count; i++)
+		{
+			if (evaluated[i] && energy[i] != 0)
+			{
+				queue(f, static_cast< slot_index >(i));
+			}
+		}
+
+		for (size_t j = 0; j < link_count; j++)
+		{
+			if (out_e[j] != 0)
+			{
+				f.links.push_back(static_cast< slot_index >(j));
+				queue_readers(*this, f, j);
+			}
+
+			if (in_e[j] != 0)
+			{
+				f.pending[j] = 1;
+				f.next_links.push_back(static_cast< slot_index >(j));
+			}
+		}
+
+		f.valid = true;
+	}
+
+	for (auto i : inputs)
+	{
+		if (evaluated[i] && energy[i] != 0)
+		{
+			queue(f, i);
+		}
+	}
+
+	for (auto i : spontaneous)
+	{
+		queue(f, i);
+	}
+
+	f.active.swap(f.next);
+	f.next.clear();
+	for (auto i : f.active)
+	{
+		f.queued[i] = 0;
+	}
+
+	if (ordered)
+	{
+		std::sort(f.active.begin(), f.active.end());
+	}
+
+	for (auto i : f.active)
+	{
+		calc_typed(*this, k, types[i], i, ea[i], energy[i], in_e, out_e);
+		if (energy[i] != 0)
+		{
+			queue(f, i);
+		}
+
+		for (size_t b = out_offsets[i]; b < out_offsets[i + 1]; b++)
+		{
+			slot_index j = out_links[b];
+			if (in_e[j] != 0 && !f.pending[j])
+			{
+				f.pending[j] = 1;
+				f.next_links.push_back(j);
+			}
+		}
+	}
+
+	// the sparse form of k.shift: out_e of the last tick is consumed or overwritten
+	for (auto j : f.links)
+	{
+		out_e[j] = 0;
+	}
+
+	for (auto j : f.next_links)
+	{
+		out_e[j] = in_e[j];
+		in_e[j] = 0;
+		f.pending[j] = 0;
+		queue_readers(*this, f, j);
+	}
+
+	f.links.swap(f.next_links);
+	f.next_links.clear();
+}
+
+template void eval_plan::run< double >(const neuron_rep&, double*, double*, double*) const;
+template void eval_plan::run< float >(const neuron_rep&, float*, float*, float*) const;
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nlab {
+
+using std::size_t;
+
+/* Dense neuron or link slot in the runtime arrays. neuron_rep/link_rep keep the 64-bit ids
+ * for the genome and serialization; a plan never holds more than 2^32 - 1 of either. */
+using slot_index = std::uint32_t;
+
+class neuron_rep;
+class link_rep;
+
+/* Active frontier of one network state for eval_plan::run_sparse: the neurons that have to be
+ * evaluated on the next tick and the links that carry energy into it.
+ * It is only valid for the state it was built on; invalidate() it whenever that state is
+ * changed by anything but run_sparse and the inputs, run_sparse rebuilds it with a full scan. */
+class eval_frontier
+{
+public:
+	void invalidate()
+	{
+		valid = false;
+	}
+
+	std::vector< slot_index > active; // neurons evaluated this tick
+	std::vector< slot_index > next; // neurons evaluated next tick
+	std::vector< slot_index > links; // links whose out_e is set
+	std::vector< slot_index > next_links; // links whose in_e is set
+	std::vector< char > queued; // neuron is in next
+	std::vector< char > pending; // link is in next_links
+	bool valid{false};
+};
+
+/* Flat evaluation plan compiled from neuron_rep/link_rep.
+ * Neurons and links are addressed by their slot in neuron_rep/link_rep as 32-bit slot_index,
+ * adjacency is kept in CSR form (in_offsets/in_links, out_offsets/out_links), so one tick costs
+ * O(neurons + links) instead of an id search per link visit.
+ * Outgoing weights are stored pre-normalized (w / sum|w| of the neuron's outputs), so weights
+ * must be changed through link_rep::set_weight to invalidate the plan.
+ * The plan holds no state of its own: run() advances one tick on caller-supplied energy arrays
+ * (neuron e, link in_e/out_e), so the same plan serves the genome's state and batch copies.
+ * Neurons are evaluated bucket by bucket with one specialized kernel per neuron_type; types
+ * are cached too, so they must be changed through neuron_rep::set_type.
+ * run() is instantiated for double and float; the float path reads out_weights_f and
+ * rounds thresholds on the fly, so the genome itself stays in double.
+ * Dead neuron_rep slots are kept in the slot numbering but never evaluated.
+ * Thresholds are read live, but their signs decide the spontaneous list, so they must be
+ * changed through neuron_rep::set_ea.
+ * compile() also prunes structure that can't affect the outputs (see prune()); the genome is
+ * left as it is, so pruned structure comes back with the next compile once it matters again.
+ * Energies are written raw only by run() and the inputs; anything else goes through
+ * neuron_rep::set_e or link_rep::set_in_e/set_out_e, which invalidate the plan when they add
+ * energy (see prune()).
+ * It is recompiled when the topology changes. */
+class eval_plan
+{
+public:
+	void compile(const neuron_rep& nr, const link_rep& lr, bool prune_unobservable = false);
+	bool is_valid(const neuron_rep& nr, const link_rep& lr) const;
+	template< typename T >
+	void run(const neuron_rep& nr, T* e, T* in_e, T* out_e) const;
+
+	/* Event-driven form of run<double>: only the frontier and its outgoing links are processed.
+	 * A neuron with zero energy and no incoming energy leaves the state unchanged unless it
+	 * emits on zero (spontaneous), so the result is the same as run's. */
+	void run_sparse(const neuron_rep& nr, eval_frontier& f, double* e, double* in_e,
+		double* out_e) const;
+
+	size_t neuron_count{0};
+	size_t link_count{0};
+
+	std::vector< slot_index > in_offsets;
+	std::vector< slot_index > in_links;
+	std::vector< slot_index > out_offsets;
+	std::vector< slot_index > out_links;
+	std::vector< double > out_weights; // normalized, indexed like out_links
+	std::vector< float > out_weights_f; // out_weights rounded to float
+
+	std::vector< slot_index > inputs;
+	std::vector< slot_index > outputs;
+
+	static const size_t neuron_type_count = 8;
+
+	// neuron slots grouped by neuron_type, bucket t is [bucket_offsets[t], bucket_offsets[t + 1])
+	std::vector< slot_index > buckets;
+	std::vector< slot_index > bucket_offsets;
+	bool ordered{false}; // evaluate in slot order, see compile()
+
+	// neurons reading link j are readers[reader_offsets[j], reader_offsets[j + 1])
+	std::vector< slot_index > reader_offsets;
+	std::vector< slot_index > readers;
+	// live neurons that emit with zero energy: gen with ea > 0, limit and binary with ea < 0
+	std::vector< slot_index > spontaneous;
+
+	std::vector< char > evaluated; // neuron slot is live and not pruned
+	size_t pruned_neurons{0}; // live neurons left out by the last compile
+	size_t pruned_links{0}; // live links no evaluated neuron touches
+	// the pruned slots themselves: the only places outside a frontier that can hold energy
+	std::vector< slot_index > skipped;
+	std::vector< slot_index > idle_links;
+	bool unobservable_pruned{false}; // compiled with prune_unobservable
+
+private:
+	void prune(const neuron_rep& nr, const link_rep& lr, bool prune_unobservable);
+	void index_readers(const std::vector< char >& reads);
+
+	bool compiled_{false};
+	std::uint64_t nr_revision_{0};
+	std::uint64_t lr_revision_{0};
+};
+
+} // namespace nlab
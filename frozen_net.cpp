@@ -0,0 +1,300 @@
+#include "frozen_net.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using namespace nlab;
+
+namespace {
+
+const std::int32_t energy_max = std::numeric_limits< std::int32_t >::max();
+const std::int32_t energy_min = std::numeric_limits< std::int32_t >::min();
+
+/* */
+std::int32_t saturate(std::int64_t x)
+{
+	return static_cast< std::int32_t >(x > energy_max ? energy_max :
+		(x < energy_min ? energy_min : x));
+}
+
+/* */
+std::int32_t add(std::int32_t a, std::int32_t b)
+{
+	return saturate(static_cast< std::int64_t >(a) + b);
+}
+
+/* Energy times weight, rounded to nearest */
+std::int32_t mul(std::int32_t eo, std::int16_t w)
+{
+	const std::int64_t half = std::int64_t(1) << (frozen_net::weight_bits - 1);
+	return saturate((static_cast< std::int64_t >(eo) * w + half) >> frozen_net::weight_bits);
+}
+
+/* x * 2^bits rounded to nearest and clamped to T, NaN is 0 */
+template< typename T >
+T to_fixed(double x, int bits)
+{
+	const double lo = std::numeric_limits< T >::min();
+	const double hi = std::numeric_limits< T >::max();
+	x = std::floor(std::ldexp(x, bits) + 0.5);
+	if (!(x == x))
+	{
+		return 0;
+	}
+
+	return static_cast< T >(x < lo ? lo : (x > hi ? hi : x));
+}
+
+/* */
+void set_eo(const frozen_net& fn, std::uint32_t n, std::int32_t eo, std::int32_t* in_e)
+{
+	for (std::uint32_t b = fn.out_offsets[n]; b < fn.out_offsets[n + 1]; b++)
+	{
+		std::int32_t& e = in_e[fn.out_links[b]];
+		e = add(e, mul(eo, fn.out_weights[b]));
+	}
+}
+
+/* */
+std::int32_t get_ei(const frozen_net& fn, std::uint32_t n, std::int32_t* out_e)
+{
+	std::int32_t s = 0;
+	for (std::uint32_t b = fn.in_offsets[n]; b < fn.in_offsets[n + 1]; b++)
+	{
+		std::int32_t& k = out_e[fn.in_links[b]];
+		s = add(s, k);
+		k = 0;
+	}
+
+	return s;
+}
+
+} // namespace
+
+/* Neurons are taken in the order eval_plan::run evaluates them. */
+frozen_net::frozen_net(tweann& nt)
+{
+	nt.update_plan();
+	const eval_plan& p = nt.plan;
+	const std::vector< neuron_type >& nt_types = nt.nr.types();
+	const std::vector< double >& nt_ea = nt.nr.ea();
+
+	std::vector< slot_index > order;
+	if (p.ordered)
+	{
+		for (size_t i = 0; i < p.neuron_count; i++)
+		{
+			if (p.evaluated[i])
+			{
+				order.push_back(static_cast< slot_index >(i));
+			}
+		}
+	}
+	else
+	{
+		order = p.buckets;
+	}
+
+	// pruned inputs and outputs still take their values, as neurons without links
+	std::vector< slot_index > idle;
+	for (auto i : p.inputs)
+	{
+		if (!p.evaluated[i])
+		{
+			idle.push_back(i);
+		}
+	}
+
+	for (auto i : p.outputs)
+	{
+		if (!p.evaluated[i])
+		{
+			idle.push_back(i);
+		}
+	}
+
+	// inputs don't read their links and outputs don't write theirs
+	const std::uint32_t none = std::numeric_limits< std::uint32_t >::max();
+	std::vector< char > read(p.link_count, 0);
+	std::vector< char > written(p.link_count, 0);
+	for (auto i : order)
+	{
+		for (size_t b = p.in_offsets[i]; b < p.in_offsets[i + 1]; b++)
+		{
+			read[p.in_links[b]] |= nt_types[i] != neuron_type::input;
+		}
+
+		for (size_t b = p.out_offsets[i]; b < p.out_offsets[i + 1]; b++)
+		{
+			written[p.out_links[b]] |= nt_types[i] != neuron_type::output;
+		}
+	}
+
+	std::vector< std::uint32_t > link_slot(p.link_count, none);
+	for (size_t j = 0; j < p.link_count; j++)
+	{
+		if (read[j] && written[j])
+		{
+			link_slot[j] = static_cast< std::uint32_t >(link_count++);
+		}
+	}
+
+	order.insert(order.end(), idle.begin(), idle.end());
+	std::vector< std::uint32_t > neuron_slot(p.neuron_count, none);
+	for (size_t k = 0; k < order.size(); k++)
+	{
+		neuron_slot[order[k]] = static_cast< std::uint32_t >(k);
+	}
+
+	in_offsets.assign(1, 0);
+	out_offsets.assign(1, 0);
+	for (auto i : order)
+	{
+		types.push_back(static_cast< std::uint8_t >(nt_types[i]));
+		ea.push_back(to_fixed< std::int32_t >(nt_ea[i], energy_bits));
+
+		if (nt_types[i] != neuron_type::input)
+		{
+			for (size_t b = p.in_offsets[i]; b < p.in_offsets[i + 1]; b++)
+			{
+				if (link_slot[p.in_links[b]] != none)
+				{
+					in_links.push_back(link_slot[p.in_links[b]]);
+				}
+			}
+		}
+
+		if (nt_types[i] != neuron_type::output)
+		{
+			for (size_t b = p.out_offsets[i]; b < p.out_offsets[i + 1]; b++)
+			{
+				if (link_slot[p.out_links[b]] != none)
+				{
+					out_links.push_back(link_slot[p.out_links[b]]);
+					out_weights.push_back(to_fixed< std::int16_t >(p.out_weights[b], weight_bits));
+				}
+			}
+		}
+
+		in_offsets.push_back(static_cast< std::uint32_t >(in_links.size()));
+		out_offsets.push_back(static_cast< std::uint32_t >(out_links.size()));
+	}
+
+	for (auto i : p.inputs)
+	{
+		inputs.push_back(neuron_slot[i]);
+	}
+
+	for (auto i : p.outputs)
+	{
+		outputs.push_back(neuron_slot[i]);
+	}
+}
+
+/* */
+void frozen_net::calc(frozen_state& st, const double* in, double* out) const
+{
+	if (st.e.size() != types.size() || st.in_e.size() != link_count)
+	{
+		throw std::runtime_error("Frozen state doesn't match network, reset it first");
+	}
+
+	std::int32_t* e = st.e.data();
+	std::int32_t* in_e = st.in_e.data();
+	std::int32_t* out_e = st.out_e.data();
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		e[inputs[i]] = add(e[inputs[i]], to_fixed< std::int32_t >(in[i], energy_bits));
+	}
+
+	const std::uint32_t count = static_cast< std::uint32_t >(types.size());
+	for (std::uint32_t i = 0; i < count; i++)
+	{
+		const std::int32_t a = ea[i];
+		switch (types[i])
+		{
+			case neuron_type::input:
+				set_eo(*this, i, e[i], in_e);
+				e[i] = 0;
+				break;
+
+			case neuron_type::output:
+				e[i] = get_ei(*this, i, out_e);
+				break;
+
+			case neuron_type::blank:
+				set_eo(*this, i, e[i], in_e);
+				e[i] = get_ei(*this, i, out_e);
+				break;
+
+			case neuron_type::activ:
+			{
+				const bool fire = !(e[i] < a);
+				set_eo(*this, i, fire ? e[i] : 0, in_e);
+				e[i] = add(fire ? 0 : e[i], get_ei(*this, i, out_e));
+				break;
+			}
+
+			case neuron_type::limit:
+			{
+				const bool fire = !(e[i] < a);
+				set_eo(*this, i, fire ? a : 0, in_e);
+				std::int32_t rest = fire ? saturate(static_cast< std::int64_t >(e[i]) - a) : e[i];
+				e[i] = add(rest, get_ei(*this, i, out_e));
+				break;
+			}
+
+			case neuron_type::binary:
+				set_eo(*this, i, (e[i] < a) ? 0 : a, in_e);
+				e[i] = get_ei(*this, i, out_e);
+				break;
+
+			case neuron_type::gen:
+				set_eo(*this, i, (e[i] < a) ? a : 0, in_e);
+				e[i] = get_ei(*this, i, out_e);
+				break;
+
+			case neuron_type::invert:
+				set_eo(*this, i, e[i], in_e);
+				e[i] = saturate(-static_cast< std::int64_t >(get_ei(*this, i, out_e)));
+				break;
+		}
+	}
+
+	if (link_count != 0)
+	{
+		std::memcpy(out_e, in_e, link_count * sizeof(std::int32_t));
+		std::memset(in_e, 0, link_count * sizeof(std::int32_t));
+	}
+
+	for (size_t i = 0; i < outputs.size(); i++)
+	{
+		out[i] = std::ldexp(static_cast< double >(e[outputs[i]]), -energy_bits);
+		e[outputs[i]] = 0;
+	}
+}
+
+/* */
+size_t frozen_net::net_bytes() const
+{
+	return types.size() * sizeof(std::uint8_t) + ea.size() * sizeof(std::int32_t) +
+		(in_offsets.size() + in_links.size() + out_offsets.size() + out_links.size() +
+		inputs.size() + outputs.size()) * sizeof(std::uint32_t) +
+		out_weights.size() * sizeof(std::int16_t);
+}
+
+/* */
+size_t frozen_net::state_bytes() const
+{
+	return (types.size() + 2 * link_count) * sizeof(std::int32_t);
+}
+
+/* Starts from rest: a frozen net doesn't carry the source network's state. */
+void frozen_state::reset(const frozen_net& fn)
+{
+	e.assign(fn.types.size(), 0);
+	in_e.assign(fn.link_count, 0);
+	out_e.assign(fn.link_count, 0);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "tweann.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nlab {
+
+class frozen_net;
+
+/* Runtime state of one instance of a frozen_net, in the net's energy format. */
+class frozen_state
+{
+public:
+	void reset(const frozen_net& fn);
+
+	std::vector< std::int32_t > e;
+	std::vector< std::int32_t > in_e;
+	std::vector< std::int32_t > out_e;
+};
+
+/* Inference-only fixed-point copy of a tweann. It keeps no ids, visuals or genome.
+ * Energies and thresholds are int32 with energy_bits fractional bits, giving a range of
+ * +-32768. Normalized weights are int16 with weight_bits fractional bits; they never exceed 1
+ * in magnitude. All arithmetic saturates.
+ * Neurons are renumbered in evaluation order and only links with both a writer and a
+ * reader are kept, so one instance costs 4 bytes per neuron and 8 per link, and the net
+ * itself can be shared by any number of frozen_states.
+ *
+ * Error bound against tweann::calc: a neuron's outgoing weights sum to at most 1 in
+ * magnitude, so a tick never amplifies an existing error. Each tick adds at most
+ *   L * (E * 2^-15 + 2^-17) + (2 * N + I) * 2^-17
+ * to the sum of absolute errors over all energies. Here L is the number of links, E the
+ * largest energy sent over a link in that tick, N the number of neurons and I the number
+ * of inputs. The first term comes from weight and product rounding, the second from
+ * threshold and input rounding.
+ * After T ticks every output is therefore within T times that bound of the double result.
+ * The bound holds while no energy leaves the +-32768 range and no activ, limit, binary or
+ * gen neuron comes within the accumulated error of its threshold. Either case can switch a
+ * neuron's decision and change the output by a whole threshold, as in float evaluation. */
+class frozen_net
+{
+public:
+	static const int energy_bits = 16;
+	static const int weight_bits = 14;
+
+	explicit frozen_net(tweann& nt);
+
+	/* One tick of instance st: in holds inputs.size() values, out receives outputs.size() */
+	void calc(frozen_state& st, const double* in, double* out) const;
+
+	/* Bytes of the shared net and of one frozen_state */
+	size_t net_bytes() const;
+	size_t state_bytes() const;
+
+	std::vector< std::uint8_t > types;
+	std::vector< std::int32_t > ea;
+	std::vector< std::uint32_t > in_offsets;
+	std::vector< std::uint32_t > in_links;
+	std::vector< std::uint32_t > out_offsets;
+	std::vector< std::uint32_t > out_links;
+	std::vector< std::int16_t > out_weights;
+	std::vector< std::uint32_t > inputs;
+	std::vector< std::uint32_t > outputs;
+	size_t link_count{0};
+};
+
+} // namespace nlab
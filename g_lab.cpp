@@ -1,50 +1,93 @@
 ﻿#include <algorithm>
 #include <iostream>
 #include <chrono>
-#include <random>
+#include <cmath>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 #include "g_lab.h"
 
 using namespace nlab;
 
-size_t g_lab::random()
+/* Seeded from the clock until seed() is called */
+g_lab::g_lab()
 {
-	static std::uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
-	static std::mt19937_64 gen(seed);
-	static std::uniform_int_distribution< std::uint32_t > dist; //borland compiler fails with 
-	//uint64_t distribution
-	return (std::uint64_t(dist(gen)) << 32) | std::uint64_t(dist(gen));
+	seed(std::chrono::system_clock::now().time_since_epoch().count());
 }
 
-size_t g_lab::random(size_t max)
+/* */
+void g_lab::seed(std::uint64_t s)
+{
+	seed_ = s;
+	rng_.seed(s);
+}
+
+size_t g_lab::random(rng& r)
+{
+	return static_cast< size_t >(r.next());
+}
+
+size_t g_lab::random(rng& r, size_t max)
 {
-	return random() % max;
+	return static_cast< size_t >(r.below(max));
 }
 
-int g_lab::random(int max)
+int g_lab::random(rng& r, int max)
 {
-	return random() % max;
+	return static_cast< int >(r.below(static_cast< std::uint64_t >(max)));
 }
 
-double g_lab::random(double max)
+double g_lab::random(rng& r, double max)
 {
-	static std::uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
-	static std::mt19937_64 gen(seed);
-	static std::uniform_real_distribution< double > dist(0, 1);
-	return dist(gen) * max;
+	return r.uniform() * max;
 }
 
 bool AcceptList[8] = {0, 0, 1, 1, 0, 1, 1, 1}; // TODO: bring into class
 
+/* Uniform live neuron slot other than skip */
+size_t g_lab::random_neuron(rng& r, const tweann* nt, size_t skip)
+{
+	size_t sz = nt->nr.size() - ((skip != neuron_rep::npos) ? 1 : 0);
+	size_t i;
+	do
+	{
+		i = random(r, sz);
+		if (i >= skip)
+		{
+			i++;
+		}
+	}
+	while (!nt->nr.alive(i));
+
+	return i;
+}
+
+/* Uniform live link slot, there must be one */
+size_t g_lab::random_link(rng& r, const tweann* nt)
+{
+	size_t i;
+	do
+	{
+		i = random(r, nt->lr.size());
+	}
+	while (!nt->lr.alive(i));
+
+	return i;
+}
+
 /* */
-void g_lab::generate_neuron(tweann* nt)
+void g_lab::generate_neuron(tweann* nt, rng& r)
 {
 	if (nt == nullptr)
 	{
 		throw;
 	}
 
-	if (nt->nr.neurons.size() > 150) //TODO: extract constant as class property
+	if (nt->nr.live_count() > 150) //TODO: extract constant as class property
 	{
 		return;
 	}
@@ -53,13 +96,12 @@ void g_lab::generate_neuron(tweann* nt)
 	const int visc = 1;
 	for (int i = 0; i < count; i++)
 	{
-		neuron_c* N = nt->nr.get_c(nt->nr.insert(neuron())); //TODO: try optimize
-		neuron_v* V = N->parent()->v;
+		neuron N;
 		int rt = -1;
 		int j = 0;
 		while (rt == -1)
 		{
-			rt = random(6) + 2;
+			rt = random(r, 6) + 2;
 			if (!AcceptList[rt])
 			{ //TODO: Cache list out of while
 				rt = -1;
@@ -68,16 +110,22 @@ void g_lab::generate_neuron(tweann* nt)
 			j++;
 			if (j > 100)
 			{
-				nt->nr.free(N->id);
-
 				return;
 			}
 		}
 
-		N->type = static_cast< neuron_type >(rt);
-		V->x = random(400);
-		V->y = random(400);
-		V->r = 20;
+		N.type = static_cast< neuron_type >(rt);
+		neuron_v v; // drawn either way, so nets with and without a layout mutate alike
+		v.x = random(r, 400);
+		v.y = random(r, 400);
+		v.r = 20;
+		N.id = nt->nr.insert(N);
+		if (nt->has_layout())
+		{
+			nt->visual(N.id) = v;
+		}
+
+		const size_t n = nt->nr.slot(N.id);
 
 		for (int k = 0; k < visc; k++)
 		{
@@ -86,37 +134,36 @@ void g_lab::generate_neuron(tweann* nt)
 			while
 			(
 				ri == ro ||
-				nt->nr.neurons[ri].c->type == neuron_type::output ||
-				nt->nr.neurons[ro].c->type == neuron_type::input
+				nt->nr.at(ri).type == neuron_type::output ||
+				nt->nr.at(ro).type == neuron_type::input
 			)
 			{
-				ri = random(nt->nr.neurons.size() - 1);
-				ro = random(nt->nr.neurons.size() - 1);
+				ri = random_neuron(r, nt, n);
+				ro = random_neuron(r, nt, n);
 			}
 
-			nt->lr.create(nt->nr.neurons[ri].c->id, N->id, random(1000) / 1000.0);
-			nt->lr.create(N->id, nt->nr.neurons[ro].c->id, random(1000) / 1000.0);
+			nt->lr.create(nt->nr.at(ri).id, N.id, random(r, 1000) / 1000.0);
+			nt->lr.create(N.id, nt->nr.at(ro).id, random(r, 1000) / 1000.0);
 		}
 	}
 }
 
 /* */
-void g_lab::delete_neuron(tweann* nt)
+void g_lab::delete_neuron(tweann* nt, rng& r)
 {
 	if (nt == nullptr)
 	{
 		throw;
 	}
 
-	neuron_c* L = nullptr;
+	size_t L = neuron_rep::npos;
 	int i = 0;
-	size_t sz = nt->nr.neurons.size();
-	while (L == nullptr)
+	while (L == neuron_rep::npos)
 	{
-		L = nt->nr.neurons[random(sz)].c;
-		if (L->type == neuron_type::input || L->type == neuron_type::output)
+		L = random_neuron(r, nt);
+		if (nt->nr.at(L).type == neuron_type::input || nt->nr.at(L).type == neuron_type::output)
 		{
-			L = nullptr;
+			L = neuron_rep::npos;
 		}
 
 		if (++i > 100)
@@ -125,68 +172,74 @@ void g_lab::delete_neuron(tweann* nt)
 		}
 	}
 
-	nt->nr.safe_free(L->id);
+	nt->nr.safe_free(nt->nr.at(L).id);
 }
 
 /* */
-void g_lab::change_weight(tweann* nt)
+void g_lab::change_weight(tweann* nt, rng& r)
 {
 	if (nt == nullptr)
 	{
 		throw;
 	}
 
-	if (nt->lr.links.empty())
+	if (nt->lr.live_count() == 0)
 	{
 		return;
 	}
 
-	double& lw = nt->lr.links[random(nt->lr.links.size())].w;
+	size_t j = random_link(r, nt);
+	double lw = nt->lr.weights()[j];
 	if (lw > 0)
 	{
 		if (lw < 10)
 		{
-			lw *= (random(4145) + 8000) / 10000.0;
+			lw *= (random(r, 4145) + 8000) / 10000.0;
 		}
 		else
 		{
-			lw *= (random(2000) + 8000) / 10000.0;
+			lw *= (random(r, 2000) + 8000) / 10000.0;
 		}
 	}
 	else
 	{
-		lw = random(150) / 1000.0;
+		lw = random(r, 150) / 1000.0;
 	}
+
+	nt->lr.set_weight(j, lw);
 }
 
 /* */
-void g_lab::change_activation(tweann* nt)
+void g_lab::change_activation(tweann* nt, rng& r)
 {
 	if (nt == nullptr)
 	{
 		throw;
 	}
 
-	double& ea = nt->nr.neurons[random(nt->nr.neurons.size())].c->ea;
+	size_t n = random_neuron(r, nt);
+	double ea = nt->nr.ea()[n];
 	if (ea > 0)
 	{
 		if (ea < 10)
 		{
-			ea *= (random(4145) + 8000) / 10000.0;
+			ea *= (random(r, 4145) + 8000) / 10000.0;
 		}
 		else
 		{
-			ea *= (random(2000) + 8000) / 10000.0;
+			ea *= (random(r, 2000) + 8000) / 10000.0;
 		}
 	}
 	else
 	{
-		ea = random(150) / 1000.0;
+		ea = random(r, 150) / 1000.0;
 	}
+
+	nt->nr.set_ea(n, ea);
 }
 
 /* */
-void g_lab::make_link(tweann* nt)
+void g_lab::make_link(tweann* nt, rng& r)
 {
 	if (nt == nullptr)
 	{
@@ -199,21 +252,16 @@ void g_lab::make_link(tweann* nt)
 	while
 	(
 		ri == ro ||
-		nt->nr.neurons[ri].c->type == neuron_type::output ||
-		nt->nr.neurons[ro].c->type == neuron_type::input
+		nt->nr.at(ri).type == neuron_type::output ||
+		nt->nr.at(ro).type == neuron_type::input
 	)
 	{
-		ri = random(nt->nr.neurons.size());
-		ro = random(nt->nr.neurons.size());
-		for (size_t j = 0; j < nt->lr.links.size(); j++)
+		ri = random_neuron(r, nt);
+		ro = random_neuron(r, nt);
+		if (nt->lr.exists(nt->nr.at(ri).id, nt->nr.at(ro).id))
 		{
-			if (nt->lr.links[j].in == nt->nr.neurons[ri].c->id &&
-				nt->lr.links[j].out == nt->nr.neurons[ro].c->id)
-			{
-				ri = 0;
-				ro = 0;
-				break;
-			}
+			ri = 0;
+			ro = 0;
 		}
 
 		if (++i > 100)
@@ -222,28 +270,29 @@ void g_lab::make_link(tweann* nt)
 		}
 	}
 
-	nt->lr.create(nt->nr.neurons[ri].c->id, nt->nr.neurons[ro].c->id, random(1000) / 1000.0);
+	nt->lr.create(nt->nr.at(ri).id, nt->nr.at(ro).id, random(r, 1000) / 1000.0);
 }
 
 /* */
-void g_lab::delete_link(tweann* nt)
+void g_lab::delete_link(tweann* nt, rng& r)
 {
 	if (nt == nullptr)
 	{
 		throw;
 	}
 
-	if (nt->lr.links.empty())
+	if (nt->lr.live_count() == 0)
 	{
 		return;
 	}
 
-	size_t rnd = random(nt->lr.links.size());
-	nt->lr.remove(nt->lr.links[rnd].in, nt->lr.links[rnd].out);
+	size_t rnd = random_link(r, nt);
+	const link& l = nt->lr.links()[rnd];
+	nt->lr.remove(l.in, l.out);
 }
 
 /* */
-void g_lab::change_neuron_type(tweann* nt)
+void g_lab::change_neuron_type(tweann* nt, rng& r)
 {
 	if (nt == nullptr)
 	{
@@ -252,11 +301,10 @@ void g_lab::change_neuron_type(tweann* nt)
 
 	size_t rnd;
 	size_t i = 0;
-	size_t sz = nt->nr.neurons.size();
 	while (true)
 	{
-		rnd = random(sz);
-		neuron_type& tp = nt->nr.neurons[rnd].c->type;
+		rnd = random_neuron(r, nt);
+		const neuron_type& tp = nt->nr.at(rnd).type;
 		if (tp != neuron_type::input && tp != neuron_type::output)
 		{
 			break;
@@ -272,7 +320,7 @@ void g_lab::change_neuron_type(tweann* nt)
 	i = 0;
 	while (rt == -1)
 	{
-		rt = random(6) + 2;
+		rt = random(r, 6) + 2;
 		if (AcceptList[rt] == false)
 		{ //TODO: get list out of while
 			rt = -1;
@@ -284,54 +332,66 @@ void g_lab::change_neuron_type(tweann* nt)
 		}
 	}
 
-	nt->nr.neurons[rnd].c->type = static_cast< neuron_type >(rt);
+	nt->nr.set_type(rnd, static_cast< neuron_type >(rt));
 }
 
 /* */
-void g_lab::mutate(tweann* nt)
+void g_lab::mutate(tweann* nt, rng& r)
 {
 	if (nt == nullptr)
 	{
 		throw;
 	}
 
-	int a = random(1000);
+	int a = random(r, 1000);
 	if (a < 70) //TODO: extract magic numbers as class properties
 	{
-		generate_neuron(nt);
+		generate_neuron(nt, r);
 	}
 	else if (a < 140)
 	{
-		delete_neuron(nt);
+		delete_neuron(nt, r);
 	}
 	else if (a < 260)
 	{
-		make_link(nt);
+		make_link(nt, r);
 	}
 	else if (a < 380)
 	{
-		delete_link(nt);
+		delete_link(nt, r);
 	}
 	else if (a < 680)
 	{
-		change_weight(nt);
+		change_weight(nt, r);
 	}
 	else if (a < 880)
 	{
-		change_activation(nt);
+		change_activation(nt, r);
 	}
 	else
 	{
-		change_neuron_type(nt);
+		change_neuron_type(nt, r);
 	}
 }
 
+/* */
+void g_lab::mutate(tweann* nt)
+{
+	mutate(nt, rng_);
+}
+
 /* */
 void g_lab::full_mutate(tweann* nt)
+{
+	full_mutate(nt, rng_);
+}
+
+/* */
+void g_lab::full_mutate(tweann* nt, rng& r)
 {
 	for (int i = 0; i < 1000; i++)
 	{
-		mutate(nt);
+		mutate(nt, r);
 	}
 }
 
@@ -342,92 +402,342 @@ bool g_lab::pn_sort(tweann* a, tweann* b)
 }
 
 /* */
-void g_lab::fitness_sort(std::vector< tweann * >& nts)
+bool g_lab::rank_sort(const ranked& a, const ranked& b)
 {
-	std::sort(nts.begin(), nts.end(), g_lab::pn_sort);
+	return a.fitness > b.fitness;
 }
 
 /* */
+void g_lab::fitness_sort(std::vector< tweann * >& nts)
+{
+	fitness_sort(nts, nts.size());
+}
+
+/* Fitness is read once per net into ranking_, so neither the selection nor the sort of the
+ * survivors touches the nets themselves. */
+void g_lab::fitness_sort(std::vector< tweann * >& nts, size_t keep)
+{
+	keep = std::min(keep, nts.size());
+	ranking_.resize(nts.size());
+	for (size_t i = 0; i < nts.size(); i++)
+	{
+		ranking_[i].fitness = nts[i]->fitness;
+		ranking_[i].net = nts[i];
+	}
+
+	if (keep < nts.size())
+	{
+		std::nth_element(ranking_.begin(), ranking_.begin() + keep, ranking_.end(),
+			g_lab::rank_sort);
+	}
+
+	std::sort(ranking_.begin(), ranking_.begin() + keep, g_lab::rank_sort);
+	for (size_t i = 0; i < nts.size(); i++)
+	{
+		nts[i] = ranking_[i].net;
+	}
+}
+
+/* Offspring i is a mutated copy of the survivor i - nts.size() / 2 */
 void g_lab::pop_mutate(std::vector< tweann * >& nts)
 {
-	for (size_t i = nts.size() / 2; i < nts.size(); i++)
+	const size_t half = nts.size() / 2;
+	std::vector< size_t > parents;
+	for (size_t i = half; half != 0 && i < nts.size(); i++)
 	{
-		delete nts[i];
-		nts[i] = new tweann(*nts[i - nts.size() / 2]);
-		nts[i]->fitness = 0;
-		mutate(nts[i]);
-		if (random(500) > 498) //TODO: extract constant as class property
-		{
-			full_mutate(nts[i]);
-		}
+		parents.push_back((i - half) % half);
 	}
+
+	breed(nts, parents);
 }
 
-/* */
+/* Draws every parent among the survivors nts[0, nts.size() / 2) as set by selection. Setup is
+ * O(n); each draw is O(log n) for roulette and rank and O(tournament_size) for tournament. */
 void g_lab::pop_mutate_1(std::vector< tweann * >& nts)
 {
-	double smax = 0;
-	for (size_t i = 0; i < nts.size() / 2; i++)
+	const size_t half = nts.size() / 2;
+	if (half == 0)
 	{
-		smax += nts[i]->fitness;
+		return;
 	}
 
-	for (size_t i = nts.size() / 2; i < nts.size(); i++)
+	std::vector< size_t > parents;
+	if (selection == selection_mode::tournament)
 	{
-		delete nts[i];
+		for (size_t i = half; i < nts.size(); i++)
+		{
+			size_t best = random(rng_, half);
+			for (size_t t = 1; t < tournament_size; t++)
+			{
+				size_t j = random(rng_, half);
+				if (nts[j]->fitness > nts[best]->fitness)
+				{
+					best = j;
+				}
+			}
+
+			parents.push_back(best);
+		}
+
+		breed(nts, parents);
+		return;
+	}
 
-		double rnd = random(smax) + 1;
-		size_t j = 0;
-		double sum = 0;
-		while (sum < rnd && j < nts.size() / 2 - 1)
+	// cumulative weights, searched once per offspring; negative fitness counts as 0
+	std::vector< double > wheel(half);
+	double sum = 0;
+	for (size_t j = 0; j < half; j++)
+	{
+		sum += (selection == selection_mode::rank) ? static_cast< double >(half - j) :
+			std::max(nts[j]->fitness, 0.0);
+		wheel[j] = sum;
+	}
+
+	for (size_t i = half; i < nts.size(); i++)
+	{
+		if (sum <= 0)
 		{
-			sum += nts[j]->fitness;
-			j++;
+			parents.push_back(random(rng_, half));
+			continue;
 		}
 
-		j--;
-		nts[i] = new tweann(*nts[j]);
-		nts[i]->fitness = 0;
-		mutate(nts[i]);
-		if (random(500) > 498)
+		size_t j = std::upper_bound(wheel.begin(), wheel.end(), random(rng_, sum)) -
+			wheel.begin();
+		parents.push_back(std::min(j, half - 1));
+	}
+
+	breed(nts, parents);
+}
+
+/* Work of one breed() call: offspring are taken one at a time from next, so a full_mutate
+ * doesn't hold up the rest. */
+struct g_lab::breed_queue
+{
+	breed_queue(std::vector< tweann * >& n, const std::vector< size_t >& p, std::uint64_t s) :
+		nts(n), parents(p), seed(s)
+	{
+	}
+
+	std::vector< tweann * >& nts;
+	const std::vector< size_t >& parents;
+	const std::uint64_t seed;
+	std::atomic< size_t > next{0};
+	std::mutex lock;
+	std::exception_ptr error;
+};
+
+/* Replaces the last parents.size() nets by mutated copies of nts[parents[k]], which must all
+ * be survivors. Offspring i draws only from stream i of a seed taken from the master stream,
+ * and parents aren't written, so the result doesn't depend on the number of threads or on
+ * which thread breeds what. */
+void g_lab::breed(std::vector< tweann * >& nts, const std::vector< size_t >& parents)
+{
+	breed_queue q(nts, parents, random(rng_));
+	size_t n = (threads != 0) ? threads : std::thread::hardware_concurrency();
+	n = std::min(std::max< size_t >(n, 1), parents.size());
+
+	pool_.run(std::vector< std::function< void() > >(n,
+		std::bind(&g_lab::breed_worker, this, std::ref(q))));
+
+	if (q.error)
+	{
+		std::rethrow_exception(q.error);
+	}
+}
+
+/* */
+void g_lab::breed_worker(breed_queue& q)
+{
+	try
+	{
+		const size_t first = q.nts.size() - q.parents.size();
+		for (size_t k = q.next++; k < q.parents.size(); k = q.next++)
+		{
+			const size_t i = first + k;
+			rng r(q.seed, i);
+			delete q.nts[i];
+			q.nts[i] = new tweann(*q.nts[q.parents[k]]);
+			q.nts[i]->id = random(r);
+			q.nts[i]->fitness = 0;
+			mutate(q.nts[i], r);
+			if (random(r, 500) > 498) //TODO: extract constant as class property
+			{
+				full_mutate(q.nts[i], r);
+			}
+
+			q.nts[i]->compact();
+		}
+	}
+	catch (...)
+	{
+		std::lock_guard< std::mutex > guard(q.lock);
+		if (!q.error)
 		{
-			full_mutate(nts[i]);
+			q.error = std::current_exception();
 		}
+
+		q.next = q.parents.size();
 	}
 }
 
 extern int g_Callback(callback_info nf);
 
+/* Shared by the environments of one gen_cycle: nets are handed out in groups of each env's
+ * count, g_Callback and cps are serialized by lock. Every episode of the generation is played
+ * on seed, the restart after an env's last group moves it to next_seed. */
+struct g_lab::eval_queue
+{
+	eval_queue(std::vector< tweann * >& n, size_t& c) : nts(n), cps(c) { }
+
+	std::vector< tweann * >& nts;
+	size_t& cps;
+	std::uint64_t seed{0};
+	std::uint64_t next_seed{0};
+	std::atomic< size_t > next{0};
+	std::atomic< bool > stop{false};
+	std::mutex lock;
+	std::shared_timed_mutex population; // see callback_info::population
+	std::exception_ptr error;
+};
+
 /* */
 int g_lab::gen_cycle(std::vector< tweann * >& nts, base_env* env, size_t& cps)
+{
+	return gen_cycle(nts, std::vector< base_env * >(1, env), cps);
+}
+
+/* Each environment gets its own thread, the first one the caller's, the others from pool_.
+ * A net is only touched by the thread evaluating it, so fitness needs no merging; with one
+ * environment everything stays on the caller's thread and runs exactly as before. */
+int g_lab::gen_cycle(std::vector< tweann * >& nts, const std::vector< base_env * >& envs,
+	size_t& cps)
+{
+	if (envs.empty())
+	{
+		throw std::runtime_error("No environment to evaluate on");
+	}
+
+	// the first group of every env is given out in env order, so which env is left without
+	// one (see run_episodes) doesn't depend on timing; the first env always gets one
+	eval_queue q(nts, cps);
+	q.seed = envs.front()->get_state().round_seed;
+	q.next_seed = random(rng_);
+	std::vector< size_t > first(envs.size());
+	for (size_t k = 0; k < envs.size(); k++)
+	{
+		first[k] = q.next.fetch_add(group_size(envs[k]));
+	}
+
+	if (envs.size() == 1)
+	{
+		return run_episodes(q, envs.front(), first.front());
+	}
+
+	std::vector< int > res(envs.size(), 0);
+	std::vector< std::function< void() > > jobs;
+	for (size_t k = 0; k < envs.size(); k++)
+	{
+		jobs.push_back(std::bind(&g_lab::run_env, this, std::ref(q), envs[k], first[k],
+			std::ref(res[k])));
+	}
+
+	pool_.run(jobs);
+
+	if (q.error)
+	{
+		std::rethrow_exception(q.error);
+	}
+
+	for (auto r : res)
+	{
+		if (r != 0)
+		{
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+/* Thread body of gen_cycle: the first error stops every environment and is rethrown */
+void g_lab::run_env(eval_queue& q, base_env* env, size_t first, int& res)
+{
+	try
+	{
+		res = run_episodes(q, env, first);
+	}
+	catch (...)
+	{
+		std::lock_guard< std::mutex > guard(q.lock);
+		if (!q.error)
+		{
+			q.error = std::current_exception();
+		}
+
+		q.stop = true;
+		res = -1;
+	}
+}
+
+/* Nets evaluated by env in one episode */
+size_t g_lab::group_size(const base_env* env)
 {
 	size_t cnt = env->get_state().count;
-	cnt = (cnt != 0) ? cnt : 1;
+	return (cnt != 0) ? cnt : 1;
+}
 
-	for (size_t i = 0; i < nts.size(); i++)
+/* Episodes on env from the group at first until the queue runs out. An env that got no group
+ * in an earlier generation still holds an older round seed: before its first group it plays
+ * an episode without nets and is restarted on q.seed, so all fitness of a generation comes
+ * from the same scenario. */
+int g_lab::run_episodes(eval_queue& q, base_env* env, size_t first)
+{
+	std::vector< tweann * >& nts = q.nts;
+	const size_t cnt = group_size(env);
+	bool prime = env->get_state().round_seed != q.seed;
+	// given up only while waiting for the callback
+	std::shared_lock< std::shared_timed_mutex > hold(q.population);
+
+	std::vector< basic_batch_state< float > > fst(single_precision ? cnt : 0);
+	std::vector< float > f_in;
+	std::vector< float > f_out;
+	std::vector< float > f_prev;
+	n_send_info nsinf; // reused, so a tick doesn't allocate once the buffers are sized
+	size_t cps = 0; // added to q.cps before every callback
+
+	while (first < nts.size())
 	{
 		std::vector< tweann * > ntt;
 
 		for (size_t j = 0; j < cnt; j++)
 		{
-			if (i >= nts.size())
+			if (prime || first + j >= nts.size())
 			{
 				ntt.push_back(nullptr);
 				continue;
 			}
 
-			ntt.push_back(nts[i]);
-			i++;
+			ntt.push_back(nts[first + j]);
 			ntt.back()->reset();
 			ntt.back()->fitness = 0;
+			ntt.back()->event_driven = event_driven;
+			ntt.back()->prune_unobservable = true; // reset above, and before every cycle
+			ntt.back()->update_plan();
+			if (single_precision)
+			{
+				fst[j].reset(*ntt.back(), 1);
+			}
 		}
 
-		i--;
-
 		/* if(nt->fts!=0&&urandom(1000)<750)
 		 continue; */
 		while (true)
 		{
+			if (q.stop)
+			{
+				return -1;
+			}
+
 			e_send_info esinf;
 			esinf = env->get();
 
@@ -455,6 +765,7 @@ int g_lab::gen_cycle(std::vector< tweann * >& nts, base_env* env, size_t& cps)
 
 			if (esinf.head == verification_header::stop)
 			{
+				q.stop = true;
 				return -1;
 			}
 
@@ -463,22 +774,19 @@ int g_lab::gen_cycle(std::vector< tweann * >& nts, base_env* env, size_t& cps)
 				throw std::runtime_error("Internal error:\nesinf.data.size() != cnt");
 			}
 
-			std::vector< env_task > rsr;
-			net_task In;
-			net_task Out;
+			const size_t outcount = env->get_state().outcount;
+			const size_t ticks = env->get_state().ticks;
+			// settle_eps 0 means plain multi-tick, calc_ticks_into settles only for eps >= 0
+			const double eps = (env->get_state().settle_eps > 0) ? env->get_state().settle_eps : -1;
+			nsinf.data.resize(ntt.size());
 			for (size_t k = 0; k < ntt.size(); k++)
 			{
 				tweann* nt = ntt[k];
-				In = esinf.data[k];
+				const net_task& In = esinf.data[k];
+				net_task& Out = nsinf.data[k];
+				Out.assign(outcount, 0);
 				if (nt == nullptr || In.empty())
 				{
-					Out.clear();
-					for (unsigned int z = 0; z < env->get_state().outcount; z++)
-					{
-						Out.push_back(0);
-					}
-
-					rsr.push_back(Out);
 					continue;
 				}
 
@@ -490,47 +798,80 @@ int g_lab::gen_cycle(std::vector< tweann * >& nts, base_env* env, size_t& cps)
 
 				cps++;
 				nt->fitness++;
-				Out = nt->calc(In);
-
-				if (Out.size() != env->get_state().outcount)
+				if (nt->plan.outputs.size() != outcount)
 				{
 					throw std::runtime_error(
 						"Internal error:\nOut.size() != env->GetState().outcount");
 				}
 
-				rsr.push_back(Out);
+				if (single_precision)
+				{
+					if (nt->plan.inputs.size() != In.size())
+					{
+						throw std::runtime_error(
+							"Internal error:\nIn.size() != nt->plan.inputs.size()");
+					}
+
+					f_in.assign(In.begin(), In.end());
+					f_out.resize(outcount);
+					for (size_t t = 0; t < ticks; t++)
+					{
+						f_prev.assign(f_out.begin(), f_out.end());
+						nt->calc_batch(fst[k], f_in.data(), f_out.data());
+
+						bool stable = t > 0 && eps >= 0;
+						for (size_t o = 0; o < outcount && stable; o++)
+						{
+							stable = !(std::fabs(f_out[o] - f_prev[o]) > eps);
+						}
+
+						if (stable)
+						{
+							break;
+						}
+					}
+
+					Out.assign(f_out.begin(), f_out.end());
+				}
+				else
+				{
+					nt->calc_ticks_into(In.data(), In.size(), Out.data(), Out.size(), ticks, eps);
+				}
 			}
 
-			n_send_info nsinf;
 			nsinf.head = verification_header::ok;
-			nsinf.data = rsr;
 			env->set(nsinf);
 
 			callback_info nf;
-			nf.cps = &cps;
+			nf.cps = &q.cps;
 			nf.in = &esinf.data.front();
 			nf.out = &nsinf.data.front();
 			nf.net = ntt.front();
 			nf.count = cnt;
-			if (g_Callback(nf) != 0)
+			nf.population = &q.population;
+
+			hold.unlock();
 			{
-				return -1;
+				std::lock_guard< std::mutex > guard(q.lock);
+				q.cps += cps;
+				cps = 0;
+				if (q.stop || g_Callback(nf) != 0)
+				{
+					q.stop = true;
+					return -1;
+				}
 			}
+
+			hold.lock();
 		}
 
+		const size_t next = prime ? first : q.next.fetch_add(cnt);
+		prime = false;
 		n_restart_info nrinf;
 		nrinf.count = cnt;
-		if (i + 1 < nts.size())
-		{
-			nrinf.round_seed = env->get_state().round_seed;
-		}
-		else 
-		{
-			nrinf.round_seed = random();
-		}
-
+		nrinf.round_seed = (next < nts.size()) ? q.seed : q.next_seed;
 		env->restart(nrinf);
-		
+		first = next;
 	}
 
 	return 0;
@@ -548,26 +889,48 @@ void g_lab::pop_gen(std::vector< tweann * >& nts, size_t popsize, size_t in, siz
 	while (nts.size() < popsize)
 	{
 		nts.push_back(new tweann(in, out));
+		nts.back()->id = random(rng_);
 		//it maybe also need to pre-init net; like full_mutate(nts)
 	}
 }
 
 /* */
 int g_lab::cycle(std::vector< tweann * >& nts, base_env* env, size_t popsize, size_t& cps)
+{
+	return cycle(nts, std::vector< base_env * >(1, env), popsize, cps);
+}
+
+/* */
+int g_lab::cycle(std::vector< tweann * >& nts, const std::vector< base_env * >& envs,
+	size_t popsize, size_t& cps)
 {
 	if (popsize < 2)
 	{
 		throw std::runtime_error("Population size < 2!");
 	}
 
-	pop_gen(nts, popsize, env->get_state().incount, env->get_state().outcount);
+	if (envs.empty())
+	{
+		throw std::runtime_error("No environment to evaluate on");
+	}
+
+	const env_state st = envs.front()->get_state();
+	for (auto env : envs)
+	{
+		if (env->get_state().incount != st.incount || env->get_state().outcount != st.outcount)
+		{
+			throw std::runtime_error("Environments differ in input or output count");
+		}
+	}
+
+	pop_gen(nts, popsize, st.incount, st.outcount);
 
-	if (gen_cycle(nts, env, cps) != 0)
+	if (gen_cycle(nts, envs, cps) != 0)
 	{
 		return -1;
 	}
 
-	fitness_sort(nts);
+	fitness_sort(nts, nts.size() / 2);
 
 	std::cout << "Best: " << nts[0]->fitness << "\n";
 
@@ -2,36 +2,116 @@
 
 #include "tweann.h"
 #include "env.h"
+#include "rng.h"
+#include "worker_pool.h"
+
+#include <cstdint>
+#include <shared_mutex>
 
 namespace nlab
 {
 
+	// how pop_mutate_1 picks the parent of each offspring among the survivors
+	enum class selection_mode
+	{
+		roulette = 0, // proportional to fitness
+		tournament, // fittest of tournament_size uniform draws
+		rank // proportional to half - rank; the survivors must be ranked (see fitness_sort)
+	};
+
 	class g_lab
 	{
 	public:
+		g_lab();
+
+		/* Restarts the master stream from s. Everything g_lab draws comes from it, so a run
+		 * is reproduced by its seed. */
+		void seed(std::uint64_t s);
 
-		void generate_neuron(tweann* nt);
-		void delete_neuron(tweann* nt);
-		void change_weight(tweann* nt);
-		void make_link(tweann* nt);
-		void delete_link(tweann* nt);
-		void change_activation(tweann* nt);
-		void change_neuron_type(tweann* nt);
+		std::uint64_t seed() const
+		{
+			return seed_;
+		}
+
+		// mutation operators, drawing from r
+		void generate_neuron(tweann* nt, rng& r);
+		void delete_neuron(tweann* nt, rng& r);
+		void change_weight(tweann* nt, rng& r);
+		void make_link(tweann* nt, rng& r);
+		void delete_link(tweann* nt, rng& r);
+		void change_activation(tweann* nt, rng& r);
+		void change_neuron_type(tweann* nt, rng& r);
+		void mutate(tweann* nt, rng& r);
+		void full_mutate(tweann* nt, rng& r);
+
+		// the same on the master stream
 		void mutate(tweann* nt);
 		void full_mutate(tweann* nt);
 
 		void fitness_sort(std::vector< tweann * >& nts);
+
+		/* Moves the keep fittest nets to the front, best first; the order of the rest is
+		 * unspecified. Selection only needs the survivors ranked, which is O(n + keep log keep)
+		 * instead of a full sort. */
+		void fitness_sort(std::vector< tweann * >& nts, size_t keep);
 		static bool pn_sort(tweann* a, tweann* b);
 		void pop_gen(std::vector< tweann * >& nts, size_t popsize, size_t in, size_t out);
 		void pop_mutate(std::vector< tweann * >& nts);
 		void pop_mutate_1(std::vector< tweann * >& nts);
 		int gen_cycle(std::vector< tweann * >& nts, base_env* env, size_t& cps);
 		int cycle(std::vector< tweann * >& nts, base_env* env, size_t popsize, size_t& cps);
+
+		// evaluate the population on several environments at once, one thread each; every
+		// environment takes the next group of its count nets until all are evaluated. The
+		// threads, like the breeding ones, are kept by g_lab from one generation to the next
+		int gen_cycle(std::vector< tweann * >& nts, const std::vector< base_env * >& envs,
+			size_t& cps);
+		int cycle(std::vector< tweann * >& nts, const std::vector< base_env * >& envs,
+			size_t popsize, size_t& cps);
+
+		// evaluate the population in float (see tweann::calc_batch); genomes stay double
+		bool single_precision{false};
+		// evaluate the population with tweann::event_driven set (double precision only)
+		bool event_driven{false};
+		// threads breeding offspring in pop_mutate/pop_mutate_1, 0 is one per core; the
+		// offspring are the same for any value
+		size_t threads{0};
+		// parent selection of pop_mutate_1
+		selection_mode selection{selection_mode::roulette};
+		// nets drawn per tournament with selection_mode::tournament
+		size_t tournament_size{2};
 	private:
-		static size_t random();
-		static size_t random(size_t max);
-		static int random(int max);
-		static double random(double max);
+		struct eval_queue;
+
+		int run_episodes(eval_queue& q, base_env* env, size_t first);
+		void run_env(eval_queue& q, base_env* env, size_t first, int& res);
+		static size_t group_size(const base_env* env);
+
+		struct breed_queue;
+
+		// population entry for ranking: the comparator reads the fitness next to the pointer
+		struct ranked
+		{
+			double fitness;
+			tweann* net;
+		};
+
+		static bool rank_sort(const ranked& a, const ranked& b);
+
+		void breed(std::vector< tweann * >& nts, const std::vector< size_t >& parents);
+		void breed_worker(breed_queue& q);
+
+		static size_t random_neuron(rng& r, const tweann* nt, size_t skip = neuron_rep::npos);
+		static size_t random_link(rng& r, const tweann* nt);
+		static size_t random(rng& r);
+		static size_t random(rng& r, size_t max);
+		static int random(rng& r, int max);
+		static double random(rng& r, double max);
+
+		rng rng_; // master stream
+		worker_pool pool_; // threads of breed and gen_cycle
+		std::vector< ranked > ranking_; // scratch of fitness_sort, kept across generations
+		std::uint64_t seed_{0};
 	};
 
 	struct callback_info
@@ -41,6 +121,9 @@ namespace nlab
 		net_task* out{nullptr};
 		tweann* net{nullptr};
 		size_t count{0};
+		// held shared by every environment thread while it touches nets, except while it
+		// waits for the callback; lock it to read or change the population from the callback
+		std::shared_timed_mutex* population{nullptr};
 	};
 
 } //namespace nlab
\ No newline at end of file
@@ -35,58 +35,50 @@ namespace json_routines
 		unsigned maxlid = 0;
 
 		auto& neurons = doc[L"neurons"];
-		nt->nr.neurons.clear();
+		nt->nr.clear();
 		for (auto dn = neurons.Begin(); dn != neurons.End(); dn++)
 		{
-			nt->nr.neurons.push_back(nlab::neuron());
-
-			nlab::neuron* n = &nt->nr.neurons.back();
-			n->c->id = (*dn)[L"id"].GetUint64();
-			n->c->type = nlab::neuron_type((*dn)[L"type"].GetUint());
-			n->c->e = (*dn)[L"energy"].GetDouble();
-			n->c->ea = (*dn)[L"e_active"].GetDouble();
-
-			n->c->in.clear();
+			nlab::neuron n;
+			n.id = (*dn)[L"id"].GetUint64();
+			n.type = nlab::neuron_type((*dn)[L"type"].GetUint());
+			n.e = (*dn)[L"energy"].GetDouble();
+			n.ea = (*dn)[L"e_active"].GetDouble();
 
 			auto& in = (*dn)[L"in"];
 			for (auto id = in.Begin(); id != in.End(); id++)
 			{
-				n->c->in.push_back(id->GetUint64());
+				n.in.push_back(id->GetUint64());
 			}
 
-			n->c->out.clear();
-
 			auto& out = (*dn)[L"out"];
 			for (auto id = out.Begin(); id != out.End(); id++)
 			{
-				n->c->out.push_back(id->GetUint64());
+				n.out.push_back(id->GetUint64());
 			}
 
-			n->rep = &nt->nr;
-			if (maxnid < unsigned(n->c->id))
+			nt->nr.restore(n);
+			if (maxnid < unsigned(n.id))
 			{
-				maxnid = n->c->id;
+				maxnid = n.id;
 			}
 		}
 
 		auto& links = doc[L"links"];
-		nt->lr.links.clear();
+		nt->lr.clear();
 		for (auto dl = links.Begin(); dl != links.End(); dl++)
 		{
-			nt->lr.links.push_back(nlab::link());
-
-			nlab::link* l = &nt->lr.links.back();
-			l->id = (*dl)[L"id"].GetUint64();
-			l->in_e = (*dl)[L"e_in"].GetDouble();
-			l->out_e = (*dl)[L"e_out"].GetDouble();
-			l->w = (*dl)[L"weight"].GetDouble();
-			l->in = (*dl)[L"in"].GetUint64();
-			l->out = (*dl)[L"out"].GetUint64();
-
-			l->rep = &nt->lr;
-			if (maxlid < unsigned(l->id))
+			nlab::link l;
+			l.id = (*dl)[L"id"].GetUint64();
+			l.in = (*dl)[L"in"].GetUint64();
+			l.out = (*dl)[L"out"].GetUint64();
+			nt->lr.restore(l, (*dl)[L"weight"].GetDouble());
+
+			size_t j = nt->lr.slot(l.id);
+			nt->lr.set_in_e(j, (*dl)[L"e_in"].GetDouble());
+			nt->lr.set_out_e(j, (*dl)[L"e_out"].GetDouble());
+			if (maxlid < unsigned(l.id))
 			{
-				maxlid = l->id;
+				maxlid = l.id;
 			}
 		}
 
@@ -99,15 +91,16 @@ namespace json_routines
 		for (auto dv = v_neurons.Begin(); dv != v_neurons.End(); dv++)
 		{
 			int id = (*dv)[L"id"].GetUint64();
-			nlab::neuron* n = nt->nr.get(id);
-			if (n == nullptr)
+			size_t i = nt->nr.slot(id);
+			if (i == nlab::neuron_rep::npos)
 			{
 				continue;
 			}
 
-			n->v->x = (*dv)[L"x"].GetDouble();
-			n->v->y = (*dv)[L"y"].GetDouble();
-			n->v->r = (*dv)[L"r"].GetDouble();
+			nlab::neuron_v& v = nt->visual(nt->nr.ids()[i]);
+			v.x = (*dv)[L"x"].GetDouble();
+			v.y = (*dv)[L"y"].GetDouble();
+			v.r = (*dv)[L"r"].GetDouble();
 		}
 		return nt;
 	}
@@ -159,22 +152,28 @@ namespace json_routines
 
 		doc.Key(L"neurons");
 		doc.StartArray();
-		for (auto n = nt->nr.neurons.begin(); n != nt->nr.neurons.end(); ++n)
+		nlab::neuron_layout layout = nt->layout();
+		for (size_t i = 0; i < nt->nr.size(); i++)
 		{
+			if (!nt->nr.alive(i))
+			{
+				continue;
+			}
+
+			nlab::const_neuron_c n = nt->nr.at(i);
 			doc.StartObject();
 			doc.Key(L"id");
-			doc.Uint64(n->c->id); //TODO: V807 http://www.viva64.com/en/V807 Decreased performance.
-								  //Consider creating a pointer to avoid using the 'n->c' expression repeatedly.
+			doc.Uint64(n.id);
 			doc.Key(L"type");
-			doc.Uint(n->c->type);
+			doc.Uint(n.type);
 			doc.Key(L"energy");
-			doc.Double(n->c->e);
+			doc.Double(n.e);
 			doc.Key(L"e_active");
-			doc.Double(n->c->ea);
+			doc.Double(n.ea);
 
 			doc.Key(L"in");
 			doc.StartArray();
-			for (auto j = n->c->in.begin(); j != n->c->in.end(); ++j)
+			for (auto j = n.in.begin(); j != n.in.end(); ++j)
 			{
 				doc.Uint64(*j);
 			}
@@ -183,7 +182,7 @@ namespace json_routines
 
 			doc.Key(L"out");
 			doc.StartArray();
-			for (auto j = n->c->out.begin(); j != n->c->out.end(); ++j)
+			for (auto j = n.out.begin(); j != n.out.end(); ++j)
 			{
 				doc.Uint64(*j);
 			}
@@ -197,17 +196,23 @@ namespace json_routines
 
 		doc.Key(L"links");
 		doc.StartArray();
-		for (auto l = nt->lr.links.begin(); l != nt->lr.links.end(); ++l)
+		for (size_t j = 0; j < nt->lr.size(); j++)
 		{
+			if (!nt->lr.alive(j))
+			{
+				continue;
+			}
+
+			const nlab::link* l = &nt->lr.links()[j];
 			doc.StartObject();
 			doc.Key(L"id");
 			doc.Uint64(l->id);
 			doc.Key(L"e_in");
-			doc.Double(l->in_e);
+			doc.Double(nt->lr.in_e()[j]);
 			doc.Key(L"e_out");
-			doc.Double(l->out_e);
+			doc.Double(nt->lr.out_e()[j]);
 			doc.Key(L"weight");
-			doc.Double(l->w);
+			doc.Double(nt->lr.weights()[j]);
 			doc.Key(L"in");
 			doc.Uint64(l->in);
 			doc.Key(L"out");
@@ -221,18 +226,23 @@ namespace json_routines
 		doc.StartObject();
 		doc.Key(L"neurons");
 		doc.StartArray();
-		for (auto n = nt->nr.neurons.begin(); n != nt->nr.neurons.end(); ++n)
+		for (size_t i = 0; i < nt->nr.size(); i++)
 		{
+			if (!nt->nr.alive(i))
+			{
+				continue;
+			}
+
+			const nlab::neuron_v& v = layout[nt->nr.ids()[i]];
 			doc.StartObject();
 			doc.Key(L"id");
-			doc.Uint64(n->c->id);
+			doc.Uint64(nt->nr.ids()[i]);
 			doc.Key(L"x");
-			doc.Double(n->v->x); //TODO: V807 http://www.viva64.com/en/V807 Decreased performance.
-								 //Consider creating a pointer to avoid using the 'n->v' expression repeatedly.
+			doc.Double(v.x);
 			doc.Key(L"y");
-			doc.Double(n->v->y);
+			doc.Double(v.y);
 			doc.Key(L"r");
-			doc.Double(n->v->r);
+			doc.Double(v.r);
 			doc.EndObject();
 		}
 
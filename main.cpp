@@ -7,6 +7,9 @@
 #include <thread>
 #include <codecvt>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
 
 #include "tcp_stream.h"
 #include "remote_env.h"
@@ -50,7 +53,7 @@ struct nlab_worker
 		paused
 	} state = stopped;
 
-	remote_env env;
+	std::vector< std::unique_ptr< remote_env > > envs;
 	g_lab gl;
 	std::vector< tweann * > nts;
 	size_t cps = 0;
@@ -66,13 +69,13 @@ struct nlab_worker
 	const std::string save_dir_prefix = "nets/";
 	bool save_dir_changed = false;
 
-	std::string connection_uri = "tcp://127.1:5005";
+	std::vector< std::string > connection_uris{"tcp://127.1:5005"};
+	size_t env_connections = 1; // connections opened to every URI, evaluated in parallel
 
 	size_t ticks = 0, max_ticks = 0;
 
-	nlab_worker() : env(std::make_unique<tcp_stream>(307200))
-	{
-	}
+	std::uint64_t seed = 0; // master seed of the run, see g_lab::seed
+	bool seed_set = false; // given by start, otherwise taken from the clock
 
 	void teach();
 	void do_idle();
@@ -131,12 +134,29 @@ rapidjson::Value method_get_state(const rapidjson::Value& /* params */, const ra
 	res.AddMember("max_round", worker.rounds, allocator);
 	res.AddMember("round", worker.cur_round, allocator);
 	res.AddMember("popsize", worker.popsize, allocator);
+	res.AddMember("seed", worker.seed, allocator);
 	res.AddMember("save_dir",
 	              rapidjson::Value().SetString(worker.save_dir.c_str(), allocator),
 	              allocator);
 
-	res.AddMember("env_uri", rapidjson::Value().SetString(
-		worker.connection_uri.c_str(), allocator), allocator);
+	if (worker.connection_uris.size() == 1)
+	{
+		res.AddMember("env_uri", rapidjson::Value().SetString(
+			worker.connection_uris.front().c_str(), allocator), allocator);
+	}
+	else
+	{
+		rapidjson::Value uris;
+		uris.SetArray();
+		for (auto& uri : worker.connection_uris)
+		{
+			uris.PushBack(rapidjson::Value().SetString(uri.c_str(), allocator), allocator);
+		}
+
+		res.AddMember("env_uri", uris, allocator);
+	}
+
+	res.AddMember("env_connections", worker.env_connections, allocator);
 
 	switch (worker.state)
 	{
@@ -199,9 +219,16 @@ rapidjson::Value method_start(const rapidjson::Value& params, const rapidjson::V
 
 	worker.max_ticks = 0;
 	worker.ticks = 0;
+	worker.seed_set = false;
 
 	if (params.IsObject())
 	{
+		if (params.HasMember("seed") && params["seed"].IsUint64())
+		{
+			worker.seed = params["seed"].GetUint64();
+			worker.seed_set = true;
+		}
+
 		if (params.HasMember("save_dir") && params["save_dir"].IsString())
 		{
 			worker.save_dir = params["save_dir"].GetString();
@@ -219,7 +246,35 @@ rapidjson::Value method_start(const rapidjson::Value& params, const rapidjson::V
 
 		if (params.HasMember("env_uri") && params["env_uri"].IsString())
 		{
-			worker.connection_uri = params["env_uri"].GetString();
+			worker.connection_uris.assign(1, params["env_uri"].GetString());
+		}
+
+		if (params.HasMember("env_uri") && params["env_uri"].IsArray() &&
+			!params["env_uri"].Empty())
+		{
+			const rapidjson::Value& uris = params["env_uri"];
+			worker.connection_uris.clear();
+			for (rapidjson::SizeType k = 0; k < uris.Size(); k++)
+			{
+				if (uris[k].IsString())
+					worker.connection_uris.push_back(uris[k].GetString());
+			}
+		}
+
+		if (params.HasMember("env_connections") && params["env_connections"].IsUint() &&
+			params["env_connections"].GetUint() > 0)
+		{
+			worker.env_connections = params["env_connections"].GetUint();
+		}
+
+		if (params.HasMember("precision") && params["precision"].IsString())
+		{
+			worker.gl.single_precision = std::string(params["precision"].GetString()) == "float";
+		}
+
+		if (params.HasMember("event_driven") && params["event_driven"].IsBool())
+		{
+			worker.gl.event_driven = params["event_driven"].GetBool();
 		}
 	}
 
@@ -273,19 +328,9 @@ void nlab_worker::do_idle()
 	}
 }
 
-void nlab_worker::teach()
+/* Opens a connection given as tcp://host:port or winpipe://./name */
+std::unique_ptr< remote_env > connect_env(const std::string& connection_uri)
 {
-	cur_round = 0;
-	last_best = 0;
-	last_speed = 0;
-
-	if (!worker.save_dir_changed)
-		worker.save_dir = worker.generate_save_dir();
-
-	create_folder(worker.get_save_dir());
-
-	cout << "Connecting...";
-
 	auto colon_ind = connection_uri.find("://");
 	if (colon_ind == std::string::npos)
 		throw std::invalid_argument("couldn't parse connection URI");
@@ -298,8 +343,8 @@ void nlab_worker::teach()
 		auto port_ind = uri_net_part.find(":");
 		if (port_ind == std::string::npos)
 			throw std::invalid_argument("couldn't parse connection URI");
-		env = remote_env( std::make_unique<tcp_stream>(uri_net_part.substr(0, port_ind),
-			uri_net_part.substr(port_ind + 1), 307200 ));
+		return std::make_unique<remote_env>( std::make_unique<tcp_stream>(
+			uri_net_part.substr(0, port_ind), uri_net_part.substr(port_ind + 1), 307200 ));
 	}
 	else if (scheme == "winpipe")
 	{
@@ -309,30 +354,64 @@ void nlab_worker::teach()
 		if (slash_ind == std::string::npos)
 			throw std::invalid_argument("couldn't parse connection URI");
 		std::cout << "winpipes: " << uri_net_part.substr(slash_ind + 1) << std::endl;
-		env = remote_env( std::make_unique<pipe_stream>(uri_net_part.substr(slash_ind + 1).c_str(),
-			307200, 307200 ) );
+		return std::make_unique<remote_env>( std::make_unique<pipe_stream>(
+			uri_net_part.substr(slash_ind + 1).c_str(), 307200, 307200 ) );
 #else
 		throw std::runtime_error("winpipe not avaliable on this platform");
 #endif
 	}
 	else throw std::invalid_argument("unknown connection URI scheme");
+}
+
+void nlab_worker::teach()
+{
+	cur_round = 0;
+	last_best = 0;
+	last_speed = 0;
+
+	if (!worker.save_dir_changed)
+		worker.save_dir = worker.generate_save_dir();
+
+	create_folder(worker.get_save_dir());
+
+	if (!seed_set)
+		seed = std::chrono::system_clock::now().time_since_epoch().count();
+	gl.seed(seed);
+
+	cout << "Connecting...";
+
+	envs.clear();
+	for (auto& uri : connection_uris)
+	{
+		for (size_t k = 0; k < env_connections; k++)
+		{
+			envs.push_back(connect_env(uri));
+			envs.back()->init();
+		}
+	}
 
-	env.init();
 	cout << " done\n";
 
 	cout << "Starting...";
 
-	e_start_info esinf = env.get_start_info();
-	n_start_info nsinf;
-	nsinf.count = esinf.count ? esinf.count : 1;
+	// every env starts on the same round seed, g_lab keeps them on one per generation
+	std::vector< base_env * > env_ptrs;
+	for (auto& env : envs)
+	{
+		e_start_info esinf = env->get_start_info();
+		n_start_info nsinf;
+		nsinf.count = esinf.count ? esinf.count : 1;
+
+		nsinf.round_seed = seed;
+		env->set_start_info(nsinf);
+		env_ptrs.push_back(env.get());
+	}
 
-	nsinf.round_seed = std::chrono::system_clock::now().time_since_epoch().count();
-	env.set_start_info(nsinf);
 	cout << " done\n";
 
 	while (1)
 	{
-		cout << "Round " << cur_round << " of " << rounds << " started\n";
+		cout << "Round " << cur_round << " of " << rounds << " started (seed " << seed << ")\n";
 		if (cur_round >= rounds && rounds > 0)
 		{
 			break;
@@ -340,7 +419,7 @@ void nlab_worker::teach()
 
 		try
 		{
-			if (gl.cycle(nts, &env, popsize, cps) != 0)
+			if (gl.cycle(nts, env_ptrs, popsize, cps) != 0)
 			{
 				break;
 			}
@@ -378,14 +457,17 @@ void nlab_worker::teach()
 	cout << "Stopping...";
 	worker.state = stopped;
 
-	try
-	{
-		e_send_info eseinf = env.get();
-		env.stop();
-	}
-	catch (exception& e)
+	for (auto& env : envs)
 	{
-		std::cerr << e.what() << std::endl;
+		try
+		{
+			e_send_info eseinf = env->get();
+			env->stop();
+		}
+		catch (exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+		}
 	}
 
 	cout << " done\n";
@@ -420,7 +502,7 @@ int main(int argc, char* argv[])
 
 	if (argc > 2)
 	{
-		worker.connection_uri = argv[2];
+		worker.connection_uris.assign(1, argv[2]);
 	}
 
 	if (argc > 3)
@@ -486,13 +568,22 @@ int main(int argc, char* argv[])
 }
 
 /* */
-int g_Callback(callback_info /* nf */)
+/* RPCs read worker.nts: wait until the other environment threads are out of the nets */
+void hold_population(const callback_info& nf, std::unique_lock< std::shared_timed_mutex >& hold)
+{
+	if (nf.population != nullptr && !hold.owns_lock())
+		hold = std::unique_lock< std::shared_timed_mutex >(*nf.population);
+}
+
+int g_Callback(callback_info nf)
 {
 	static std::chrono::high_resolution_clock::time_point now, t1, t2;
+	std::unique_lock< std::shared_timed_mutex > hold;
 
 	worker.ticks++;
 	if (worker.max_ticks && worker.ticks > worker.max_ticks)
 	{
+		hold_population(nf, hold);
 		worker.state = nlab_worker::paused;
 		cout << "Paused" << endl;
 		worker.do_idle();
@@ -503,6 +594,7 @@ int g_Callback(callback_info /* nf */)
 	now = std::chrono::high_resolution_clock::now();
 	if (std::chrono::duration_cast < std::chrono::milliseconds > (now - t2).count() > worker_update_time)
 	{
+		hold_population(nf, hold);
 		handle_json_message();
 		
 		t2 = std::chrono::high_resolution_clock::now();
@@ -0,0 +1,298 @@
+#include "native_net.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+using namespace nlab;
+
+namespace {
+
+/* A literal that reads back as exactly x: 17 significant digits round-trip a double, the
+ * rest goes through its bit pattern. */
+std::string literal(double x)
+{
+	char buf[64];
+	if (std::isfinite(x))
+	{
+		std::snprintf(buf, sizeof(buf), "%.17g", x);
+		if (std::strpbrk(buf, ".e") == nullptr)
+		{
+			std::strcat(buf, ".0");
+		}
+
+		return std::string("(") + buf + ")";
+	}
+
+	std::uint64_t b;
+	std::memcpy(&b, &x, sizeof(b));
+	std::snprintf(buf, sizeof(buf), "bits(0x%016llxULL)", static_cast< unsigned long long >(b));
+	return buf;
+}
+
+/* set_eo of eval_plan.cpp */
+void emit_set_eo(std::ostringstream& s, const eval_plan& p, size_t i, const std::string& eo)
+{
+	if (p.out_offsets[i] == p.out_offsets[i + 1])
+	{
+		return;
+	}
+
+	s << "\teo = " << eo << ";\n";
+	for (size_t b = p.out_offsets[i]; b < p.out_offsets[i + 1]; b++)
+	{
+		s << "\tin_e[" << p.out_links[b] << "] += eo * " << literal(p.out_weights[b]) << ";\n";
+	}
+}
+
+/* get_ei of eval_plan.cpp, the sum is left in s */
+void emit_get_ei(std::ostringstream& s, const eval_plan& p, size_t i)
+{
+	s << "\ts = 0.0;\n";
+	for (size_t b = p.in_offsets[i]; b < p.in_offsets[i + 1]; b++)
+	{
+		s << "\ts += out_e[" << p.in_links[b] << "];\n";
+		s << "\tout_e[" << p.in_links[b] << "] = 0;\n";
+	}
+}
+
+/* calc_neuron of eval_plan.cpp with the type and threshold resolved */
+void emit_neuron(std::ostringstream& s, const eval_plan& p, size_t i, neuron_type type,
+	double ea)
+{
+	std::ostringstream es;
+	es << "e[" << i << "]";
+	const std::string e = es.str();
+	const std::string a = literal(ea);
+
+	switch (type)
+	{
+		case neuron_type::input:
+			emit_set_eo(s, p, i, e);
+			s << "\t" << e << " = 0;\n";
+			break;
+
+		case neuron_type::output:
+			emit_get_ei(s, p, i);
+			s << "\t" << e << " = s;\n";
+			break;
+
+		case neuron_type::blank:
+			emit_set_eo(s, p, i, e);
+			emit_get_ei(s, p, i);
+			s << "\t" << e << " = s;\n";
+			break;
+
+		case neuron_type::activ:
+			s << "\tfire = !(" << e << " < " << a << ");\n";
+			emit_set_eo(s, p, i, "fire ? " + e + " : 0.0");
+			s << "\t" << e << " = fire ? 0.0 : " << e << ";\n";
+			emit_get_ei(s, p, i);
+			s << "\t" << e << " += s;\n";
+			break;
+
+		case neuron_type::limit:
+			s << "\tfire = !(" << e << " < " << a << ");\n";
+			emit_set_eo(s, p, i, "fire ? " + a + " : 0.0");
+			s << "\t" << e << " = fire ? " << e << " - " << a << " : " << e << ";\n";
+			emit_get_ei(s, p, i);
+			s << "\t" << e << " += s;\n";
+			break;
+
+		case neuron_type::binary:
+			emit_set_eo(s, p, i, "(" + e + " < " + a + ") ? 0.0 : " + a);
+			emit_get_ei(s, p, i);
+			s << "\t" << e << " = s;\n";
+			break;
+
+		case neuron_type::gen:
+			emit_set_eo(s, p, i, "(" + e + " < " + a + ") ? " + a + " : 0.0");
+			emit_get_ei(s, p, i);
+			s << "\t" << e << " = s;\n";
+			break;
+
+		case neuron_type::invert:
+			emit_set_eo(s, p, i, e);
+			emit_get_ei(s, p, i);
+			s << "\t" << e << " = -1.0 * s;\n";
+			break;
+	}
+}
+
+} // namespace
+
+/* Neurons are emitted in the order eval_plan::run evaluates them. */
+std::string nlab::generate_cpp(tweann& nt)
+{
+	nt.update_plan();
+	const eval_plan& p = nt.plan;
+	const std::vector< neuron_type >& types = nt.nr.types();
+	const std::vector< double >& ea = nt.nr.ea();
+
+	std::ostringstream s;
+	s << "#include <cstring>\n\n"
+		<< "namespace {\n\n"
+		<< "inline double bits(unsigned long long b)\n{\n"
+		<< "\tdouble x;\n\tstd::memcpy(&x, &b, sizeof(x));\n\treturn x;\n}\n\n"
+		<< "} // namespace\n\n"
+		<< "extern \"C\" void nlab_calc(double* e, double* in_e, double* out_e, const double* in,"
+		<< " double* out)\n{\n"
+		<< "\tdouble eo = 0;\n\tdouble s = 0;\n\tbool fire = false;\n"
+		<< "\t(void)bits;\n\t(void)eo;\n\t(void)s;\n\t(void)fire;\n"
+		<< "\t(void)in_e;\n\t(void)out_e;\n\n";
+
+	for (size_t i = 0; i < p.inputs.size(); i++)
+	{
+		s << "\te[" << p.inputs[i] << "] += in[" << i << "];\n";
+	}
+
+	if (p.ordered)
+	{
+		for (size_t i = 0; i < p.neuron_count; i++)
+		{
+			if (p.evaluated[i])
+			{
+				emit_neuron(s, p, i, types[i], ea[i]);
+			}
+		}
+	}
+	else
+	{
+		for (size_t b = 0; b < p.buckets.size(); b++)
+		{
+			emit_neuron(s, p, p.buckets[b], types[p.buckets[b]], ea[p.buckets[b]]);
+		}
+	}
+
+	if (p.link_count != 0)
+	{
+		s << "\tstd::memcpy(out_e, in_e, " << p.link_count << " * sizeof(double));\n";
+		s << "\tstd::memset(in_e, 0, " << p.link_count << " * sizeof(double));\n";
+	}
+
+	for (size_t i = 0; i < p.outputs.size(); i++)
+	{
+		s << "\tout[" << i << "] = e[" << p.outputs[i] << "];\n";
+		s << "\te[" << p.outputs[i] << "] = 0;\n";
+	}
+
+	s << "}\n";
+	return s.str();
+}
+
+/* The source and the shared object live in a private directory made by mkdtemp, so nobody
+ * else can plant or swap the object between compiling and loading it; all three are removed
+ * as soon as the object is loaded. */
+native_net::native_net(tweann& nt) : net(nt)
+{
+	const std::string code = generate_cpp(net);
+	nr_revision_ = net.nr.revision;
+	lr_revision_ = net.lr.revision;
+
+#ifndef _WIN32
+	const char* cxx = std::getenv("NLAB_CXX");
+	const char* tmp = std::getenv("TMPDIR");
+	std::string dir = std::string(tmp != nullptr ? tmp : "/tmp") + "/nlab_XXXXXX";
+	if (mkdtemp(&dir[0]) == nullptr)
+	{
+		return;
+	}
+
+	const std::string src = dir + "/net.cpp";
+	const std::string so = dir + "/net.so";
+
+	std::ofstream f(src);
+	f << code;
+	f.close();
+	if (f.fail())
+	{
+		std::remove(src.c_str());
+		rmdir(dir.c_str());
+		return;
+	}
+
+	const std::string cmd = std::string(cxx != nullptr ? cxx : "c++") +
+		" -O2 -ffp-contract=off -fPIC -shared -o \"" + so + "\" \"" + src + "\" > /dev/null 2>&1";
+	int rc = std::system(cmd.c_str());
+	std::remove(src.c_str());
+	if (rc == 0)
+	{
+		handle_ = dlopen(so.c_str(), RTLD_NOW | RTLD_LOCAL);
+	}
+
+	std::remove(so.c_str());
+	rmdir(dir.c_str());
+	if (handle_ != nullptr)
+	{
+		calc_ = reinterpret_cast< calc_fn >(dlsym(handle_, "nlab_calc"));
+	}
+#endif
+}
+
+/* */
+native_net::~native_net()
+{
+#ifndef _WIN32
+	if (handle_ != nullptr)
+	{
+		dlclose(handle_);
+	}
+#endif
+}
+
+/* */
+bool native_net::native() const
+{
+	return calc_ != nullptr && net.nr.revision == nr_revision_ && net.lr.revision == lr_revision_;
+}
+
+/* */
+net_task native_net::calc(const net_task& task)
+{
+	if (!native())
+	{
+		return net.calc(task);
+	}
+
+	net_task out(net.plan.outputs.size());
+	calc_into(task.data(), task.size(), out.data(), out.size());
+	return out;
+}
+
+/* */
+void native_net::calc_into(const double* in, size_t n_in, double* out, size_t n_out)
+{
+	if (!native())
+	{
+		net.calc_into(in, n_in, out, n_out);
+		return;
+	}
+
+	net.update_plan();
+	if (net.plan.inputs.size() != n_in)
+	{
+		throw std::runtime_error("Input buffer doesn't match network inputs");
+	}
+
+	if (net.plan.outputs.empty())
+	{
+		throw std::runtime_error("Network has no outputs");
+	}
+
+	if (net.plan.outputs.size() != n_out)
+	{
+		throw std::runtime_error("Output buffer doesn't match network outputs");
+	}
+
+	calc_(net.nr.e_data(), net.lr.in_e_data(), net.lr.out_e_data(), in, out);
+	net.frontier.invalidate();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "tweann.h"
+
+#include <cstdint>
+#include <string>
+
+namespace nlab {
+
+/* Straight-line C++ for one tick of nt: every slot, threshold and normalized weight is a
+ * constant and the neuron_type switch is resolved at generation time. The code defines
+ *   extern "C" void nlab_calc(double* e, double* in_e, double* out_e, const double* in,
+ *       double* out)
+ * which does what tweann::calc_into does on nr.e, lr.in_e and lr.out_e, bit for bit. */
+std::string generate_cpp(tweann& nt);
+
+/* tweann::calc_into backed by generate_cpp compiled into a shared object and loaded at run
+ * time. The compiler command is taken from NLAB_CXX, "c++" by default. When there is no
+ * compiler, loading fails or the genome has changed since, calls go to the interpreted
+ * tweann::calc_into instead, so the results are the same either way.
+ * The state stays in net, native() tells which path is in use. */
+class native_net
+{
+public:
+	explicit native_net(tweann& nt);
+	~native_net();
+
+	native_net(const native_net&) = delete;
+	native_net& operator=(const native_net&) = delete;
+
+	net_task calc(const net_task& task);
+	void calc_into(const double* in, size_t n_in, double* out, size_t n_out);
+
+	/* Generated code is used for the current genome */
+	bool native() const;
+
+	tweann& net;
+
+private:
+	using calc_fn = void (*)(double*, double*, double*, const double*, double*);
+
+	void* handle_{nullptr};
+	calc_fn calc_{nullptr};
+	std::uint64_t nr_revision_{0};
+	std::uint64_t lr_revision_{0};
+};
+
+} // namespace nlab
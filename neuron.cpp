@@ -1,236 +1,261 @@
 ﻿#include "neuron.h"
-#include <cmath>
 
 using namespace nlab;
 
+namespace {
+
 /* */
-double neuron_c::get_ei()
+void insert_id(std::vector< size_t >& offsets, std::vector< std::uint64_t >& ids, size_t i,
+	std::uint64_t id)
 {
-	double s = 0;
-	size_t sz = in.size();
-	for (size_t i = 0; i < sz; i++)
+	ids.insert(ids.begin() + offsets[i + 1], id);
+	for (size_t k = i + 1; k < offsets.size(); k++)
 	{
-		link* l = parent()->rep->link_rep_->get(in[i]); // TODO: cache
-		if (l == nullptr)
-		{
-			continue;
-		}
-
-		double k = l->out_e;
-		l->out_e = 0;
-		s += k;
+		offsets[k]++;
 	}
-
-	return s;
 }
 
 /* */
-void neuron_c::set_eo(double eo)
+void erase_id(std::vector< size_t >& offsets, std::vector< std::uint64_t >& ids, size_t i,
+	std::uint64_t id)
 {
-	double s1 = 0;
-	size_t sz = out.size();
-	for (size_t i = 0; i < sz; i++)
+	for (size_t j = offsets[i]; j < offsets[i + 1]; j++)
 	{
-		link* l = parent()->rep->link_rep_->get(out[i]); // TODO: cache
-		if (l == nullptr)
+		if (ids[j] == id)
 		{
-			continue;
-		}
+			ids.erase(ids.begin() + j);
+			for (size_t k = i + 1; k < offsets.size(); k++)
+			{
+				offsets[k]--;
+			}
 
-		s1 += std::fabs(l->w);
+			return;
+		}
 	}
+}
 
-	double lamb = 0;
-	if (s1 != 0) //TODO: V550 http://www.viva64.com/en/V550 An odd precise comparison: 
-	//s1 != 0. It's probably better to use a comparison with defined precision: 
-	//fabs(A - B) > Epsilon.
+/* Empties the range of slot i; the slot itself stays */
+void clear_slot(std::vector< size_t >& offsets, std::vector< std::uint64_t >& ids, size_t i)
+{
+	size_t count = offsets[i + 1] - offsets[i];
+	if (count == 0)
 	{
-		lamb = 1.f / s1;
+		return;
 	}
 
-	sz = out.size();
-	for (size_t i = 0; i < sz; i++)
+	ids.erase(ids.begin() + offsets[i], ids.begin() + offsets[i + 1]);
+	for (size_t k = i + 1; k < offsets.size(); k++)
 	{
-		link* l = parent()->rep->link_rep_->get(out[i]); // TODO: cache
-		if (l == nullptr)
-		{
-			continue;
-		}
-
-		l->in_e += eo * l->w * lamb;
+		offsets[k] -= count;
 	}
 }
 
 /* */
-void neuron_c::calc()
+size_t edge_hash(std::uint64_t in, std::uint64_t out)
+{
+	return slot_table::hash(in * 0x9E3779B97F4A7C15ull ^ out);
+}
+
+// Hashes and key tests of the slot_table indices, reading the keys from the columns
+
+struct neuron_id_hash
 {
-	switch (this->type)
+	size_t operator()(std::uint32_t s) const
 	{
-		case neuron_type::input:
-			set_eo(e);
-			e = 0;
-			break;
-
-		case neuron_type::output:
-			e = get_ei();
-			break;
-
-		case neuron_type::blank:
-			set_eo(e);
-			e = get_ei();
-			break;
-
-		case neuron_type::activ:
-			if (e < ea)
-			{
-				set_eo(0);
-			}
-			else
-			{
-				set_eo(e);
-				e = 0;
-			}
+		return slot_table::hash(ids[s]);
+	}
 
-			e += get_ei();
-			break;
+	const std::vector< std::uint64_t >& ids;
+};
 
-		case neuron_type::limit:
-			if (e < ea)
-			{
-				set_eo(0);
-			}
-			else
-			{
-				set_eo(ea);
-				e -= ea;
-			}
+struct neuron_has_id
+{
+	bool operator()(std::uint32_t s) const
+	{
+		return ids[s] == id;
+	}
 
-			e += get_ei();
-			break;
+	const std::vector< std::uint64_t >& ids;
+	std::uint64_t id;
+};
 
-		case neuron_type::binary:
-			if (e < ea)
-			{
-				set_eo(0);
-				e = 0;
-			}
-			else
-			{
-				set_eo(ea);
-				e = 0;
-			}
+struct link_id_hash
+{
+	size_t operator()(std::uint32_t s) const
+	{
+		return slot_table::hash(links[s].id);
+	}
 
-			e = get_ei();
-			break;
+	const std::vector< link >& links;
+};
 
-		case neuron_type::gen:
-			if (e < ea)
-			{
-				set_eo(ea);
-				e = 0;
-			}
-			else
-			{
-				set_eo(0);
-				e = 0;
-			}
+struct link_has_id
+{
+	bool operator()(std::uint32_t s) const
+	{
+		return links[s].id == id;
+	}
 
-			e = get_ei();
-			break;
+	const std::vector< link >& links;
+	std::uint64_t id;
+};
 
-		case neuron_type::invert:
-			set_eo(e);
-			e = -1.0 * get_ei();
-			break;
+struct link_edge_hash
+{
+	size_t operator()(std::uint32_t s) const
+	{
+		return edge_hash(links[s].in, links[s].out);
 	}
 
-	/* double eps = 0.01;
-	 E -= eps;
-	 if (E < 0)
-	 E = 0; */
+	const std::vector< link >& links;
+};
+
+struct link_has_edge
+{
+	bool operator()(std::uint32_t s) const
+	{
+		return links[s].in == in && links[s].out == out;
+	}
 
-	/* if (E < Ea)
-	 E = 0; */
+	const std::vector< link >& links;
+	std::uint64_t in;
+	std::uint64_t out;
+};
+
+} // namespace
+
+/* */
+neuron_c neuron_rep::at(size_t i)
+{
+	return {e_[i], params_->ea[i], topology_->ids[i], params_->types[i], in(i), out(i)};
 }
 
 /* */
-neuron* neuron_rep::get(std::uint64_t id)
+const_neuron_c neuron_rep::at(size_t i) const
 {
-	size_t sz = neurons.size();
-	for (size_t i = 0; i < sz; i++)
+	return {e_[i], params_->ea[i], topology_->ids[i], params_->types[i], in(i), out(i)};
+}
+
+/* */
+size_t neuron_rep::slot(std::uint64_t id) const
+{
+	const topology& t = *topology_;
+	std::uint32_t i = t.index.find(slot_table::hash(id), neuron_has_id{t.ids, id});
+	return (i == slot_table::none) ? npos : i;
+}
+
+/* Puts n into a dead slot if there is one, otherwise appends it */
+void neuron_rep::append(const neuron& n)
+{
+	topology& t = topology_.write();
+	params& p = params_.write();
+
+	if (!t.free_slots.empty())
 	{
-		if (neurons[i].c->id == id)
+		size_t i = t.free_slots.back();
+		t.free_slots.pop_back();
+		t.ids[i] = n.id;
+		t.index.insert(static_cast< std::uint32_t >(i), slot_table::hash(n.id),
+			neuron_id_hash{t.ids});
+		p.types[i] = n.type;
+		e_[i] = n.e;
+		p.ea[i] = n.ea;
+		for (auto id : n.in)
 		{
-			return &neurons[i];
+			insert_id(t.in_offsets, t.in_ids, i, id);
 		}
+
+		for (auto id : n.out)
+		{
+			insert_id(t.out_offsets, t.out_ids, i, id);
+		}
+
+		t.live[i] = 1;
+		revision++;
+		return;
 	}
 
-	return nullptr;
+	t.ids.push_back(n.id);
+	t.index.insert(static_cast< std::uint32_t >(t.ids.size() - 1), slot_table::hash(n.id),
+		neuron_id_hash{t.ids});
+	p.types.push_back(n.type);
+	e_.push_back(n.e);
+	p.ea.push_back(n.ea);
+	t.in_ids.insert(t.in_ids.end(), n.in.begin(), n.in.end());
+	t.in_offsets.push_back(t.in_ids.size());
+	t.out_ids.insert(t.out_ids.end(), n.out.begin(), n.out.end());
+	t.out_offsets.push_back(t.out_ids.size());
+	t.live.push_back(1);
+	revision++;
 }
 
 /* */
-neuron_c* neuron_rep::get_c(std::uint64_t id)
+std::uint64_t neuron_rep::insert(const neuron& n)
 {
-	neuron* n = get(id);
-	return (n == nullptr) ? nullptr : n->c;
+	neuron nn = n;
+	nn.id = id_counter++;
+	append(nn);
+	return nn.id;
 }
 
 /* */
-std::uint64_t neuron_rep::insert(const neuron& n)
+void neuron_rep::restore(const neuron& n)
 {
-	neurons.push_back(n);
-
-	neuron& nn = neurons.back();
-	nn.c->id = id_counter++;
-	nn.rep = this;
-	return nn.c->id;
+	append(n);
 }
 
 /* */
 void neuron_rep::free(std::uint64_t id)
 {
-	size_t sz = neurons.size();
-	for (size_t i = 0; i < sz; i++)
+	size_t i = slot(id);
+	if (i == npos)
 	{
-		if (neurons[i].c->id == id)
-		{
-			neurons.erase(neurons.begin() + i);
-			return;
-		}
+		return;
 	}
+
+	topology& t = topology_.write();
+	t.index.erase(static_cast< std::uint32_t >(i), slot_table::hash(id), neuron_id_hash{t.ids});
+	e_[i] = 0;
+	clear_slot(t.in_offsets, t.in_ids, i);
+	clear_slot(t.out_offsets, t.out_ids, i);
+	t.live[i] = 0;
+	t.free_slots.push_back(i);
+	revision++;
 }
 
 /* */
 void neuron_rep::safe_free(std::uint64_t id)
 {
-	neuron_c* n = get_c(id);
+	size_t n = slot(id);
 
-	if (n == nullptr)
+	if (n == npos)
 	{
 		return;
 	}
 
-	for (size_t i = 0; i < n->in.size(); i++)
+	// remove() edits the adjacency arrays (and may detach them), so they are re-read on
+	// every step
+	for (size_t i = 0; i < in(n).size(); i++)
 	{
-		link* l = link_rep_->get(n->in[i]);
+		const link* l = link_rep_->get(in(n)[i]);
 		if (l == nullptr)
 		{
 			continue;
 		}
 
-		l->rep->remove(l->in, l->out);
+		link_rep_->remove(l->in, l->out);
 		i--;
 	}
 
-	for (size_t i = 0; i < n->out.size(); i++)
+	for (size_t i = 0; i < out(n).size(); i++)
 	{
-		link* l = link_rep_->get(n->out[i]);
+		const link* l = link_rep_->get(out(n)[i]);
 		if (l == nullptr)
 		{
 			continue;
 		}
 
-		l->rep->remove(l->in, l->out);
+		link_rep_->remove(l->in, l->out);
 		i--;
 	}
 
@@ -238,104 +263,338 @@ void neuron_rep::safe_free(std::uint64_t id)
 }
 
 /* */
-link* link_rep::get(std::uint64_t id)
+void neuron_rep::clear()
 {
-	size_t sz = links.size();
-	for (size_t i = 0; i < sz; i++)
+	topology_ = cow_ptr< topology >();
+	params_ = cow_ptr< params >();
+	e_.clear();
+	revision++;
+}
+
+/* Drops dead slots, keeping the order of live ones. Dead slots have empty adjacency
+ * ranges, so in_ids/out_ids stay as they are and only the offsets move. */
+void neuron_rep::compact()
+{
+	if (topology_->free_slots.empty())
 	{
-		if (links[i].id == id)
+		return;
+	}
+
+	topology& t = topology_.write();
+	params& p = params_.write();
+
+	size_t j = 0;
+	for (size_t i = 0; i < t.ids.size(); i++)
+	{
+		if (!t.live[i])
 		{
-			return &links[i];
+			continue;
 		}
+
+		t.ids[j] = t.ids[i];
+		p.types[j] = p.types[i];
+		e_[j] = e_[i];
+		p.ea[j] = p.ea[i];
+		t.in_offsets[j + 1] = t.in_offsets[i + 1];
+		t.out_offsets[j + 1] = t.out_offsets[i + 1];
+		j++;
+	}
+
+	t.index.reset(j);
+	for (size_t i = 0; i < j; i++)
+	{
+		t.index.insert(static_cast< std::uint32_t >(i), slot_table::hash(t.ids[i]),
+			neuron_id_hash{t.ids});
 	}
 
-	return nullptr;
+	t.ids.resize(j);
+	p.types.resize(j);
+	e_.resize(j);
+	p.ea.resize(j);
+	t.in_offsets.resize(j + 1);
+	t.out_offsets.resize(j + 1);
+	t.live.assign(j, 1);
+	t.free_slots.clear();
+	revision++;
+}
+
+/* */
+void neuron_rep::add_in(size_t i, std::uint64_t link_id)
+{
+	topology& t = topology_.write();
+	insert_id(t.in_offsets, t.in_ids, i, link_id);
+	revision++;
 }
 
 /* */
-std::uint64_t link_rep::insert(const link& l)
+void neuron_rep::add_out(size_t i, std::uint64_t link_id)
 {
-	links.push_back(l);
+	topology& t = topology_.write();
+	insert_id(t.out_offsets, t.out_ids, i, link_id);
+	revision++;
+}
 
-	link& ll = links.back();
+/* */
+void neuron_rep::remove_in(size_t i, std::uint64_t link_id)
+{
+	topology& t = topology_.write();
+	erase_id(t.in_offsets, t.in_ids, i, link_id);
+	revision++;
+}
+
+/* */
+void neuron_rep::remove_out(size_t i, std::uint64_t link_id)
+{
+	topology& t = topology_.write();
+	erase_id(t.out_offsets, t.out_ids, i, link_id);
+	revision++;
+}
+
+/* */
+void neuron_rep::set_type(size_t i, neuron_type type)
+{
+	params_.write().types[i] = type;
+	revision++;
+}
+
+/* */
+void neuron_rep::set_ea(size_t i, double ea)
+{
+	params_.write().ea[i] = ea;
+	revision++;
+}
+
+/* */
+void neuron_rep::set_e(size_t i, double v)
+{
+	e_[i] = v;
+	if (v != 0)
+	{
+		revision++;
+	}
+}
+
+/* */
+const link* link_rep::get(std::uint64_t id) const
+{
+	size_t i = slot(id);
+	return (i == npos) ? nullptr : &topology_->links[i];
+}
+
+/* */
+size_t link_rep::slot(std::uint64_t id) const
+{
+	const topology& t = *topology_;
+	std::uint32_t i = t.index.find(slot_table::hash(id), link_has_id{t.links, id});
+	return (i == slot_table::none) ? npos : i;
+}
+
+/* Puts l into a dead slot if there is one, otherwise appends it */
+size_t link_rep::place(const link& l, double w)
+{
+	topology& t = topology_.write();
+	std::vector< double >& ws = weights_.write();
+
+	size_t i = t.links.size();
+	if (!t.free_slots.empty())
+	{
+		i = t.free_slots.back();
+		t.free_slots.pop_back();
+		t.links[i] = l;
+		ws[i] = w;
+		in_e_[i] = 0;
+		out_e_[i] = 0;
+		t.live[i] = 1;
+	}
+	else
+	{
+		t.links.push_back(l);
+		ws.push_back(w);
+		in_e_.push_back(0);
+		out_e_.push_back(0);
+		t.live.push_back(1);
+	}
+
+	t.index.insert(static_cast< std::uint32_t >(i), slot_table::hash(l.id),
+		link_id_hash{t.links});
+	t.edges.insert(static_cast< std::uint32_t >(i), edge_hash(l.in, l.out),
+		link_edge_hash{t.links});
+	revision++;
+	return i;
+}
+
+/* */
+std::uint64_t link_rep::insert(const link& l, double w)
+{
+	link ll = l;
 	ll.id = id_counter++;
-	ll.rep = this;
+	place(ll, w);
 	return ll.id;
 }
 
+/* */
+void link_rep::restore(const link& l, double w)
+{
+	place(l, w);
+}
+
 /* */
 void link_rep::free(std::uint64_t id)
 {
-	for (size_t i = 0; i < links.size(); i++)
+	size_t i = slot(id);
+	if (i == npos)
+	{
+		return;
+	}
+
+	topology& t = topology_.write();
+	const std::uint32_t s = static_cast< std::uint32_t >(i);
+	t.index.erase(s, slot_table::hash(id), link_id_hash{t.links});
+	t.edges.erase(s, edge_hash(t.links[i].in, t.links[i].out), link_edge_hash{t.links});
+	t.links[i] = link();
+	in_e_[i] = 0;
+	out_e_[i] = 0;
+	t.live[i] = 0;
+	t.free_slots.push_back(i);
+	revision++;
+}
+
+/* */
+void link_rep::clear()
+{
+	topology_ = cow_ptr< topology >();
+	weights_ = cow_ptr< std::vector< double > >();
+	in_e_.clear();
+	out_e_.clear();
+	revision++;
+}
+
+/* */
+void link_rep::set_weight(size_t i, double w)
+{
+	weights_.write()[i] = w;
+	revision++;
+}
+
+/* */
+void link_rep::set_in_e(size_t i, double v)
+{
+	in_e_[i] = v;
+	if (v != 0)
+	{
+		revision++;
+	}
+}
+
+/* */
+void link_rep::set_out_e(size_t i, double v)
+{
+	out_e_[i] = v;
+	if (v != 0)
+	{
+		revision++;
+	}
+}
+
+/* Drops dead slots, keeping the order of live ones */
+void link_rep::compact()
+{
+	if (topology_->free_slots.empty())
+	{
+		return;
+	}
+
+	topology& t = topology_.write();
+	std::vector< double >& ws = weights_.write();
+
+	size_t j = 0;
+	for (size_t i = 0; i < t.links.size(); i++)
 	{
-		if (links[i].id == id)
+		if (!t.live[i])
 		{
-			links.erase(links.begin() + i);
-			return;
+			continue;
 		}
+
+		t.links[j] = t.links[i];
+		ws[j] = ws[i];
+		in_e_[j] = in_e_[i];
+		out_e_[j] = out_e_[i];
+		j++;
 	}
+
+	t.index.reset(j);
+	t.edges.reset(j);
+	for (size_t i = 0; i < j; i++)
+	{
+		const std::uint32_t s = static_cast< std::uint32_t >(i);
+		t.index.insert(s, slot_table::hash(t.links[i].id), link_id_hash{t.links});
+		t.edges.insert(s, edge_hash(t.links[i].in, t.links[i].out), link_edge_hash{t.links});
+	}
+
+	t.links.resize(j);
+	ws.resize(j);
+	in_e_.resize(j);
+	out_e_.resize(j);
+	t.live.assign(j, 1);
+	t.free_slots.clear();
+	revision++;
 }
 
 /* */
 std::uint64_t link_rep::create(std::uint64_t from, std::uint64_t to, double w)
 {
-	link* l = get(insert(link())); // TODO: optimize
-	l->in = from;
-	l->out = to;
-	l->w = w;
+	link l;
+	l.in = from;
+	l.out = to;
+	std::uint64_t id = insert(l, w);
 
-	neuron_c* n = neuron_rep_->get_c(from);
-	if (n != nullptr)
+	size_t n = neuron_rep_->slot(from);
+	if (n != neuron_rep::npos)
 	{
-		n->out.push_back(l->id);
+		neuron_rep_->add_out(n, id);
 	}
 
-	n = neuron_rep_->get_c(to);
-	if (n != nullptr)
+	n = neuron_rep_->slot(to);
+	if (n != neuron_rep::npos)
 	{
-		n->in.push_back(l->id);
+		neuron_rep_->add_in(n, id);
 	}
 
-	return l->id;
+	return id;
 }
 
-/* */
+/* Removes every link from -> to */
 void link_rep::remove(std::uint64_t from, std::uint64_t to)
 {
-	for (size_t i = 0; i < links.size(); i++)
-	{ // TODO: cache,optimize
-		if (links[i].in == from && links[i].out == to)
+	for (const link* l = find(from, to); l != nullptr; l = find(from, to))
+	{
+		std::uint64_t id = l->id;
+		size_t n = neuron_rep_->slot(from);
+		if (n != neuron_rep::npos)
 		{
-			link* l = &links[i];
-			neuron_c* n = neuron_rep_->get_c(from);
-			if (n != nullptr)
-			{
-				for (size_t j = 0; j < n->out.size(); j++)
-				{
-					if (n->out[j] == l->id)
-					{
-						n->out.erase(n->out.begin() + j);
-						break;
-					}
-				}
-			}
-
-			n = neuron_rep_->get_c(to);
-			if (n != nullptr)
-			{
-				for (size_t j = 0; j < n->in.size(); j++)
-				{
-					if (n->in[j] == l->id)
-					{
-						n->in.erase(n->in.begin() + j);
-						break;
-					}
-				}
-			}
+			neuron_rep_->remove_out(n, id);
+		}
 
-			links.erase(links.begin() + i);
-			i--;
+		n = neuron_rep_->slot(to);
+		if (n != neuron_rep::npos)
+		{
+			neuron_rep_->remove_in(n, id);
 		}
+
+		free(id);
 	}
 }
 
+/* Any link from -> to, nullptr if there is none */
+const link* link_rep::find(std::uint64_t from, std::uint64_t to) const
+{
+	const topology& t = *topology_;
+	std::uint32_t i = t.edges.find(edge_hash(from, to), link_has_edge{t.links, from, to});
+	return (i == slot_table::none) ? nullptr : &t.links[i];
+}
+
+/* */
+bool link_rep::exists(std::uint64_t from, std::uint64_t to) const
+{
+	return find(from, to) != nullptr;
+}
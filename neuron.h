@@ -1,5 +1,8 @@
 #pragma once
 
+#include "cow_ptr.h"
+#include "slot_table.h"
+
 #include <cstddef>
 #include <cstdint>
 #include <vector>
@@ -23,16 +26,19 @@ enum neuron_type
 
 class neuron_rep;
 class link_rep;
-class neuron;
 
-class neuron_c
+class neuron_v
 {
-	friend class neuron;
-	neuron* _parent{nullptr};
-
-	double get_ei();
-	void set_eo(double eo);
+public:
+	int x{0};
+	int y{0};
+	int r{20};
+};
 
+/* Value description of a single neuron. neuron_rep stores neurons column-wise, this type
+ * is only used to hand a neuron to insert()/restore(). */
+class neuron
+{
 public:
 	double e{0.0};
 	double ea{1};
@@ -41,190 +47,287 @@ public:
 
 	std::vector< std::uint64_t > in;
 	std::vector< std::uint64_t > out;
-
-	void calc();
-
-	neuron* parent() const
-	{
-		return _parent;
-	}
-
 };
 
-class neuron_v
+/* Read-only range of link ids stored in neuron_rep adjacency arrays */
+class id_range
 {
-	friend class neuron;
-	neuron* _parent{nullptr};
+	const std::uint64_t* begin_;
+	const std::uint64_t* end_;
 
 public:
-	int x{0};
-	int y{0};
-	int r{20};
+	id_range(const std::uint64_t* b, const std::uint64_t* e) : begin_(b), end_(e) { }
 
-	neuron* parent() const
+	const std::uint64_t* begin() const
 	{
-		return _parent;
+		return begin_;
 	}
 
-};
-
-class neuron
-{
-public:
-	neuron_c* c;
-	neuron_v* v;
-	neuron_rep* rep;
-
-	neuron()
+	const std::uint64_t* end() const
 	{
-		c = new neuron_c();
-		c->_parent = this;
-		v = new neuron_v();
-		v->_parent = this;
-		rep = nullptr;
+		return end_;
 	}
 
-	~neuron()
+	size_t size() const
 	{
-		delete c;
-		delete v;
+		return static_cast< size_t >(end_ - begin_);
 	}
 
-	neuron(const neuron& nr):
-		c(new neuron_c(*nr.c)),
-		v(new neuron_v(*nr.v)),
-		rep(nr.rep)
+	bool empty() const
 	{
-		c->_parent = this;
-		v->_parent = this;
+		return begin_ == end_;
 	}
 
-	neuron& operator=(const neuron& nr)
+	std::uint64_t operator[](size_t i) const
 	{
-		if (&nr == this)
-		{
-			return *this;
-		}
-
-		delete c;
-		delete v;
-		c = new neuron_c(*nr.c);
-		c->_parent = this;
-		v = new neuron_v(*nr.v);
-		v->_parent = this;
-		rep = nr.rep;
-		return *this;
+		return begin_[i];
 	}
 };
 
+/* View of one neuron_rep slot with the field names of a single neuron.
+ * Like a pointer into a vector, it is invalidated by insert/free and adjacency changes.
+ * Every field is read-only, writes go through the neuron_rep setters so the plan notices. */
+template< bool Const >
+class neuron_view
+{
+public:
+	const double& e; // use neuron_rep::set_e
+	const double& ea; // use neuron_rep::set_ea
+	const std::uint64_t& id;
+	const neuron_type& type; // use neuron_rep::set_type
+
+	id_range in;
+	id_range out;
+};
+
+using neuron_c = neuron_view< false >;
+using const_neuron_c = neuron_view< true >;
+
 class link
 {
 public:
-	double in_e{0.0};
-	double out_e{0.0};
-	double w{0.0};
 	std::uint64_t in{0};
 	std::uint64_t out{0};
 	std::uint64_t id{0};
-
-	link_rep* rep{nullptr};
-
-	void calc()
-	{
-		out_e = in_e;
-		in_e = 0;
-	}
-	
 };
 
+/* Neurons stored as a structure of arrays: every column is indexed by slot, adjacency lists
+ * (link ids) are kept in CSR form.
+ * The adjacency holds 64-bit link ids rather than slots: ids are what the JSON form and the
+ * mutation operators refer to, and they survive free-slot reuse and compact(), which would
+ * otherwise have to renumber every list. The evaluation never reads them, eval_plan compiles
+ * its own 32-bit slot_index adjacency.
+ * The genome columns are split into copy-on-write blocks (topology, parameters), so
+ * a copy shares them with its source and a mutation only copies the block it writes to.
+ * The runtime energy e is owned by every copy. The id index is a slot_table kept in the
+ * topology block, so detaching it is a flat copy.
+ * free() only marks a slot dead and puts it on a free list that insert() reuses; compact()
+ * drops dead slots. Code walking slots has to skip dead ones. */
 class neuron_rep
 {
 public:
-	neuron* get(std::uint64_t id);
-	neuron_c* get_c(std::uint64_t id);
+	static const size_t npos = static_cast< size_t >(-1);
+
+	neuron_c at(size_t i);
+	const_neuron_c at(size_t i) const;
+	size_t slot(std::uint64_t id) const;
 	std::uint64_t insert(const neuron& n);
+	void restore(const neuron& n);
 	void free(std::uint64_t id);
 	void safe_free(std::uint64_t id);
+	void clear();
+	void compact();
+
+	void add_in(size_t i, std::uint64_t link_id);
+	void add_out(size_t i, std::uint64_t link_id);
+	void remove_in(size_t i, std::uint64_t link_id);
+	void remove_out(size_t i, std::uint64_t link_id);
+	void set_type(size_t i, neuron_type type);
+	void set_ea(size_t i, double ea);
+
+	/* Sets the energy of slot i from outside an evaluation. A nonzero energy may reach
+	 * neurons the compiled plan leaves out (see eval_plan::prune), so it invalidates the
+	 * plan. */
+	void set_e(size_t i, double v);
+
+	size_t size() const
+	{
+		return topology_->ids.size();
+	}
 
-	std::vector< neuron > neurons;
-	std::uint64_t id_counter{1};
-	link_rep* link_rep_{nullptr};
+	size_t live_count() const
+	{
+		return topology_->ids.size() - topology_->free_slots.size();
+	}
 
-	neuron_rep() = default;
+	bool alive(size_t i) const
+	{
+		return topology_->live[i] != 0;
+	}
 
-	neuron_rep& operator=(const neuron_rep& nr)
+	id_range in(size_t i) const
 	{
-		if (&nr == this)
-		{
-			return *this;
-		}
+		const topology& t = *topology_;
+		return {t.in_ids.data() + t.in_offsets[i], t.in_ids.data() + t.in_offsets[i + 1]};
+	}
 
-		neurons.clear();
-		id_counter = nr.id_counter;
-		link_rep_ = nr.link_rep_;
-		neurons.reserve(nr.neurons.size());
-		for (size_t i = 0; i < nr.neurons.size(); i++)
-		{
-			neurons.push_back(nr.neurons[i]);
-			neurons[i].rep = this;
-		}
+	id_range out(size_t i) const
+	{
+		const topology& t = *topology_;
+		return {t.out_ids.data() + t.out_offsets[i], t.out_ids.data() + t.out_offsets[i + 1]};
+	}
+
+	const std::vector< std::uint64_t >& ids() const
+	{
+		return topology_->ids;
+	}
+
+	const std::vector< neuron_type >& types() const
+	{
+		return params_->types;
+	}
+
+	const std::vector< double >& ea() const
+	{
+		return params_->ea;
+	}
 
-		return *this;
+	/* Runtime energy, indexed by slot */
+	const std::vector< double >& e() const
+	{
+		return e_;
 	}
 
-	neuron_rep(const neuron_rep& nr): neurons(nr.neurons), id_counter(nr.id_counter),
-		link_rep_(nr.link_rep_)
+	/* For the evaluation: run() and the inputs write the energies through this without
+	 * touching the revision, everything else uses set_e. */
+	double* e_data()
 	{
-		for (size_t i = 0; i < nr.neurons.size(); i++)
-		{
-			neurons[i].rep = this;
-		}
+		return e_.data();
 	}
+
+	std::uint64_t id_counter{1};
+	std::uint64_t revision{0};
+	link_rep* link_rep_{nullptr};
+
+private:
+	struct topology
+	{
+		std::vector< std::uint64_t > ids;
+		std::vector< size_t > in_offsets{0};
+		std::vector< std::uint64_t > in_ids;
+		std::vector< size_t > out_offsets{0};
+		std::vector< std::uint64_t > out_ids;
+		std::vector< std::uint8_t > live;
+		std::vector< size_t > free_slots;
+		slot_table index; // keyed by ids[slot]
+	};
+
+	struct params
+	{
+		std::vector< neuron_type > types;
+		std::vector< double > ea;
+	};
+
+	void append(const neuron& n);
+
+	cow_ptr< topology > topology_;
+	cow_ptr< params > params_;
+	std::vector< double > e_;
 };
 
+/* Links stored like neurons: the topology (link ends, free list, indices) and the weights
+ * are copy-on-write blocks, the energies in_e/out_e are owned by every copy.
+ * free() leaves a dead slot for insert() to reuse until compact().
+ * Links are also indexed by their (in, out) neuron pair; both indices are slot_tables. */
 class link_rep
 {
 public:
-	link* get(std::uint64_t id);
-	std::uint64_t insert(const link& l);
+	static const size_t npos = static_cast< size_t >(-1);
+
+	const link* get(std::uint64_t id) const;
+	size_t slot(std::uint64_t id) const;
+	std::uint64_t insert(const link& l, double w);
+	void restore(const link& l, double w);
 	void free(std::uint64_t id);
+	void clear();
 	std::uint64_t create(std::uint64_t from, std::uint64_t to, double w);
 	void remove(std::uint64_t from, std::uint64_t to);
+	const link* find(std::uint64_t from, std::uint64_t to) const;
+	bool exists(std::uint64_t from, std::uint64_t to) const;
+	void set_weight(size_t i, double w);
+	void compact();
 
-	std::vector< link > links;
-	std::uint64_t id_counter{1};
-	neuron_rep* neuron_rep_{nullptr};
+	/* Set link energies like neuron_rep::set_e */
+	void set_in_e(size_t i, double v);
+	void set_out_e(size_t i, double v);
 
-	link_rep() = default;
+	size_t size() const
+	{
+		return topology_->links.size();
+	}
+
+	size_t live_count() const
+	{
+		return topology_->links.size() - topology_->free_slots.size();
+	}
+
+	bool alive(size_t i) const
+	{
+		return topology_->live[i] != 0;
+	}
+
+	const std::vector< link >& links() const
+	{
+		return topology_->links;
+	}
 
-	link_rep& operator=(const link_rep& lr)
+	const std::vector< double >& weights() const
 	{
-		if (&lr == this)
-		{
-			return *this;
-		}
+		return *weights_;
+	}
 
-		
-		id_counter = lr.id_counter;
-		neuron_rep_ = lr.neuron_rep_;
-		links = lr.links;
+	/* Link energies, indexed like links() */
+	const std::vector< double >& in_e() const
+	{
+		return in_e_;
+	}
 
-		for (auto& i: links)
-		{
-			i.rep = this;
-		}
+	const std::vector< double >& out_e() const
+	{
+		return out_e_;
+	}
 
-		return *this;
+	/* For the evaluation, like neuron_rep::e_data */
+	double* in_e_data()
+	{
+		return in_e_.data();
 	}
 
-	link_rep(const link_rep& lr):links(lr.links), id_counter(lr.id_counter),
-		neuron_rep_(lr.neuron_rep_)
+	double* out_e_data()
 	{
-		for (auto& i : links)
-		{
-			i.rep = this;
-		}
+		return out_e_.data();
 	}
+
+	std::uint64_t id_counter{1};
+	std::uint64_t revision{0};
+	neuron_rep* neuron_rep_{nullptr};
+
+private:
+	struct topology
+	{
+		std::vector< link > links;
+		std::vector< std::uint8_t > live;
+		std::vector< size_t > free_slots;
+		slot_table index; // keyed by links[slot].id
+		slot_table edges; // keyed by (links[slot].in, links[slot].out)
+	};
+
+	size_t place(const link& l, double w);
+
+	cow_ptr< topology > topology_;
+	cow_ptr< std::vector< double > > weights_;
+	std::vector< double > in_e_;
+	std::vector< double > out_e_;
 };
 
 } // namespace nlab
\ No newline at end of file
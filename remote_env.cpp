@@ -57,11 +57,22 @@ e_start_info remote_env::get_start_info()
 	esi.count = desi["count"].GetUint64();
 	esi.incount = desi["incount"].GetUint64();
 	esi.outcount = desi["outcount"].GetUint64();
+	if (desi.HasMember("ticks") && desi["ticks"].IsUint64() && desi["ticks"].GetUint64() != 0)
+	{
+		esi.ticks = desi["ticks"].GetUint64();
+	}
+
+	if (desi.HasMember("settle_eps") && desi["settle_eps"].IsNumber())
+	{
+		esi.settle_eps = desi["settle_eps"].GetDouble();
+	}
 
 	state_.mode = esi.mode;
 	state_.count = esi.count;
 	state_.incount = esi.incount;
 	state_.outcount = esi.outcount;
+	state_.ticks = esi.ticks;
+	state_.settle_eps = esi.settle_eps;
 	return esi;
 }
 
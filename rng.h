@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nlab {
+
+/* xoshiro256** generator: 32 bytes of state, one 64-bit result per call and no shared state,
+ * so every thread can own one. The state is filled from the seed with splitmix64, which never
+ * gives the all-zero state. */
+class rng
+{
+public:
+	explicit rng(std::uint64_t seed = 0)
+	{
+		this->seed(seed);
+	}
+
+	/* Stream `stream` of seed: every (seed, stream) pair starts from its own state, so threads
+	 * or offspring can draw independently yet reproducibly. */
+	rng(std::uint64_t seed, std::uint64_t stream)
+	{
+		std::uint64_t x = stream;
+		this->seed(seed ^ splitmix64(x));
+	}
+
+	void seed(std::uint64_t seed)
+	{
+		for (auto& w : s_)
+		{
+			w = splitmix64(seed);
+		}
+	}
+
+	std::uint64_t next()
+	{
+		const std::uint64_t res = rotl(s_[1] * 5, 7) * 9;
+		const std::uint64_t t = s_[1] << 17;
+		s_[2] ^= s_[0];
+		s_[3] ^= s_[1];
+		s_[1] ^= s_[2];
+		s_[0] ^= s_[3];
+		s_[2] ^= t;
+		s_[3] = rotl(s_[3], 45);
+		return res;
+	}
+
+	/* [0, max); 0 if max is 0 */
+	std::uint64_t below(std::uint64_t max)
+	{
+		return max != 0 ? next() % max : 0;
+	}
+
+	/* [0, 1) with 53 random bits */
+	double uniform()
+	{
+		return static_cast< double >(next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+private:
+	static std::uint64_t rotl(std::uint64_t x, int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+
+	static std::uint64_t splitmix64(std::uint64_t& x)
+	{
+		std::uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	std::uint64_t s_[4];
+};
+
+} // namespace nlab
@@ -0,0 +1,302 @@
+#include "simd_kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NLAB_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NLAB_TARGET_AVX2
+#else
+#define NLAB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace nlab;
+
+namespace {
+
+/* */
+template< typename T >
+void scatter_scalar(T* in_e, const slot_index* idx, const T* w, size_t n, T eo)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		in_e[idx[i]] += eo * w[i];
+	}
+}
+
+/* */
+template< typename T >
+void shift_scalar(T* in_e, T* out_e, size_t n)
+{
+	for (size_t j = 0; j < n; j++)
+	{
+		out_e[j] = in_e[j];
+		in_e[j] = 0;
+	}
+}
+
+#ifdef NLAB_X86
+
+/* There is no scatter below AVX-512, so the products are computed in vector registers and
+ * accumulated one lane at a time; a neuron may list the same link twice. */
+void scatter_sse2(double* in_e, const slot_index* idx, const double* w, size_t n,
+	double eo)
+{
+	const __m128d veo = _mm_set1_pd(eo);
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		__m128d p = _mm_mul_pd(_mm_loadu_pd(w + i), veo);
+		in_e[idx[i]] += _mm_cvtsd_f64(p);
+		in_e[idx[i + 1]] += _mm_cvtsd_f64(_mm_unpackhi_pd(p, p));
+	}
+
+	for (; i < n; i++)
+	{
+		in_e[idx[i]] += eo * w[i];
+	}
+}
+
+/* */
+void shift_sse2(double* in_e, double* out_e, size_t n)
+{
+	const __m128d zero = _mm_setzero_pd();
+	size_t j = 0;
+	for (; j + 2 <= n; j += 2)
+	{
+		_mm_storeu_pd(out_e + j, _mm_loadu_pd(in_e + j));
+		_mm_storeu_pd(in_e + j, zero);
+	}
+
+	for (; j < n; j++)
+	{
+		out_e[j] = in_e[j];
+		in_e[j] = 0;
+	}
+}
+
+/* The AVX2 kernels clear the upper YMM halves before returning: the rest of eval_plan::run is
+ * SSE code, and the compiler doesn't insert vzeroupper for target("avx2") functions here, so
+ * every SSE instruction after them would pay the AVX-SSE transition. */
+NLAB_TARGET_AVX2 void scatter_avx2(double* in_e, const slot_index* idx, const double* w,
+	size_t n, double eo)
+{
+	const __m256d veo = _mm256_set1_pd(eo);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256d p = _mm256_mul_pd(_mm256_loadu_pd(w + i), veo);
+		__m128d lo = _mm256_castpd256_pd128(p);
+		__m128d hi = _mm256_extractf128_pd(p, 1);
+		in_e[idx[i]] += _mm_cvtsd_f64(lo);
+		in_e[idx[i + 1]] += _mm_cvtsd_f64(_mm_unpackhi_pd(lo, lo));
+		in_e[idx[i + 2]] += _mm_cvtsd_f64(hi);
+		in_e[idx[i + 3]] += _mm_cvtsd_f64(_mm_unpackhi_pd(hi, hi));
+	}
+
+	_mm256_zeroupper();
+
+	for (; i < n; i++)
+	{
+		in_e[idx[i]] += eo * w[i];
+	}
+}
+
+/* */
+NLAB_TARGET_AVX2 void shift_avx2(double* in_e, double* out_e, size_t n)
+{
+	const __m256d zero = _mm256_setzero_pd();
+	size_t j = 0;
+	for (; j + 4 <= n; j += 4)
+	{
+		_mm256_storeu_pd(out_e + j, _mm256_loadu_pd(in_e + j));
+		_mm256_storeu_pd(in_e + j, zero);
+	}
+
+	_mm256_zeroupper();
+
+	for (; j < n; j++)
+	{
+		out_e[j] = in_e[j];
+		in_e[j] = 0;
+	}
+}
+
+/* Single precision packs twice as many lanes per register. */
+void scatter_sse2(float* in_e, const slot_index* idx, const float* w, size_t n, float eo)
+{
+	const __m128 veo = _mm_set1_ps(eo);
+	alignas(16) float p[4];
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm_store_ps(p, _mm_mul_ps(_mm_loadu_ps(w + i), veo));
+		in_e[idx[i]] += p[0];
+		in_e[idx[i + 1]] += p[1];
+		in_e[idx[i + 2]] += p[2];
+		in_e[idx[i + 3]] += p[3];
+	}
+
+	for (; i < n; i++)
+	{
+		in_e[idx[i]] += eo * w[i];
+	}
+}
+
+/* */
+void shift_sse2(float* in_e, float* out_e, size_t n)
+{
+	const __m128 zero = _mm_setzero_ps();
+	size_t j = 0;
+	for (; j + 4 <= n; j += 4)
+	{
+		_mm_storeu_ps(out_e + j, _mm_loadu_ps(in_e + j));
+		_mm_storeu_ps(in_e + j, zero);
+	}
+
+	for (; j < n; j++)
+	{
+		out_e[j] = in_e[j];
+		in_e[j] = 0;
+	}
+}
+
+/* */
+NLAB_TARGET_AVX2 void scatter_avx2(float* in_e, const slot_index* idx, const float* w,
+	size_t n, float eo)
+{
+	const __m256 veo = _mm256_set1_ps(eo);
+	alignas(32) float p[8];
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm256_store_ps(p, _mm256_mul_ps(_mm256_loadu_ps(w + i), veo));
+		for (size_t l = 0; l < 8; l++)
+		{
+			in_e[idx[i + l]] += p[l];
+		}
+	}
+
+	_mm256_zeroupper();
+
+	for (; i < n; i++)
+	{
+		in_e[idx[i]] += eo * w[i];
+	}
+}
+
+/* */
+NLAB_TARGET_AVX2 void shift_avx2(float* in_e, float* out_e, size_t n)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	size_t j = 0;
+	for (; j + 8 <= n; j += 8)
+	{
+		_mm256_storeu_ps(out_e + j, _mm256_loadu_ps(in_e + j));
+		_mm256_storeu_ps(in_e + j, zero);
+	}
+
+	_mm256_zeroupper();
+
+	for (; j < n; j++)
+	{
+		out_e[j] = in_e[j];
+		in_e[j] = 0;
+	}
+}
+
+#endif
+
+const simd_kernels scalar_kernels{scatter_scalar< double >, shift_scalar< double >};
+const basic_simd_kernels< float > scalar_kernels_f{scatter_scalar< float >, shift_scalar< float >};
+#ifdef NLAB_X86
+const simd_kernels sse2_kernels{scatter_sse2, shift_sse2};
+const simd_kernels avx2_kernels{scatter_avx2, shift_avx2};
+const basic_simd_kernels< float > sse2_kernels_f{scatter_sse2, shift_sse2};
+const basic_simd_kernels< float > avx2_kernels_f{scatter_avx2, shift_avx2};
+#endif
+
+simd_level current_level = detect_simd_level();
+
+} // namespace
+
+/* */
+simd_level nlab::detect_simd_level()
+{
+#if !defined(NLAB_X86)
+	return simd_level::scalar;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	if (osxsave && avx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5))
+		{
+			return simd_level::avx2;
+		}
+	}
+
+	return sse2 ? simd_level::sse2 : simd_level::scalar;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return simd_level::avx2;
+	}
+
+	return __builtin_cpu_supports("sse2") ? simd_level::sse2 : simd_level::scalar;
+#endif
+}
+
+/* */
+simd_level nlab::set_simd_level(simd_level level)
+{
+	simd_level max = detect_simd_level();
+	current_level = (static_cast< int >(level) > static_cast< int >(max)) ? max : level;
+	return current_level;
+}
+
+/* */
+simd_level nlab::get_simd_level()
+{
+	return current_level;
+}
+
+/* */
+template< >
+const basic_simd_kernels< double >& nlab::get_simd_kernels< double >()
+{
+	switch (current_level)
+	{
+#ifdef NLAB_X86
+		case simd_level::avx2:
+			return avx2_kernels;
+		case simd_level::sse2:
+			return sse2_kernels;
+#endif
+		default:
+			return scalar_kernels;
+	}
+}
+
+/* */
+template< >
+const basic_simd_kernels< float >& nlab::get_simd_kernels< float >()
+{
+	switch (current_level)
+	{
+#ifdef NLAB_X86
+		case simd_level::avx2:
+			return avx2_kernels_f;
+		case simd_level::sse2:
+			return sse2_kernels_f;
+#endif
+		default:
+			return scalar_kernels_f;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "eval_plan.h"
+
+#include <cstddef>
+
+namespace nlab {
+
+using std::size_t;
+
+enum class simd_level
+{
+	scalar = 0,
+	sse2,
+	avx2
+};
+
+/* Link energy kernels used by eval_plan::run. The implementation is picked at runtime from
+ * what the CPU supports; every level produces bit-identical results.
+ * T is the scalar type of the evaluation (double or float). */
+template< typename T >
+struct basic_simd_kernels
+{
+	/* in_e[idx[i]] += eo * w[i], i in [0, n) */
+	void (*scatter)(T* in_e, const slot_index* idx, const T* w, size_t n, T eo);
+
+	/* out_e = in_e, in_e = 0 */
+	void (*shift)(T* in_e, T* out_e, size_t n);
+};
+
+using simd_kernels = basic_simd_kernels< double >;
+
+simd_level detect_simd_level();
+
+/* Selects the kernels for level, clamped to detect_simd_level(). Returns the level in use. */
+simd_level set_simd_level(simd_level level);
+simd_level get_simd_level();
+
+template< typename T >
+const basic_simd_kernels< T >& get_simd_kernels();
+
+template< >
+const basic_simd_kernels< double >& get_simd_kernels< double >();
+template< >
+const basic_simd_kernels< float >& get_simd_kernels< float >();
+
+} // namespace nlab
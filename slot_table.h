@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nlab {
+
+using std::size_t;
+
+/* Hash index over the slots of a column store (see neuron_rep, link_rep). The table holds
+ * nothing but 32-bit slot numbers, keys are read back from the owner's columns through the
+ * functors passed in, so it is one flat array: a copy is a memcpy and nothing is allocated
+ * per entry. Open addressing with linear probing and backward-shift deletion, at most 3/4
+ * full. Several slots may share a key, find() returns any of them.
+ * The functors: hash_of(slot) hashes the key of a slot already in the table, same(slot)
+ * tells whether a slot has the key looked for. */
+class slot_table
+{
+public:
+	static const std::uint32_t none = 0xFFFFFFFFu; // passed by value only, it has no definition
+
+	static size_t hash(std::uint64_t x)
+	{
+		x *= 0x9E3779B97F4A7C15ull;
+		return static_cast< size_t >(x ^ (x >> 32));
+	}
+
+	template< typename Same >
+	std::uint32_t find(size_t h, const Same& same) const
+	{
+		if (cells_.empty())
+		{
+			return none;
+		}
+
+		for (size_t c = h & mask(); cells_[c] != none; c = (c + 1) & mask())
+		{
+			if (same(cells_[c]))
+			{
+				return cells_[c];
+			}
+		}
+
+		return none;
+	}
+
+	/* Adds slot under hash h */
+	template< typename HashOf >
+	void insert(std::uint32_t slot, size_t h, const HashOf& hash_of)
+	{
+		if ((size_ + 1) * 4 > cells_.size() * 3)
+		{
+			grow(hash_of);
+		}
+
+		place(slot, h);
+		size_++;
+	}
+
+	/* Removes slot, which was inserted under hash h. Later entries of its probe run move up
+	 * into the hole when their home allows it, so no tombstones are left. */
+	template< typename HashOf >
+	void erase(std::uint32_t slot, size_t h, const HashOf& hash_of)
+	{
+		if (cells_.empty())
+		{
+			return;
+		}
+
+		size_t hole = h & mask();
+		while (cells_[hole] != slot)
+		{
+			if (cells_[hole] == none)
+			{
+				return;
+			}
+
+			hole = (hole + 1) & mask();
+		}
+
+		for (size_t c = (hole + 1) & mask(); cells_[c] != none; c = (c + 1) & mask())
+		{
+			size_t home = hash_of(cells_[c]) & mask();
+			if (((c - home) & mask()) >= ((c - hole) & mask()))
+			{
+				cells_[hole] = cells_[c];
+				hole = c;
+			}
+		}
+
+		cells_[hole] = none;
+		size_--;
+	}
+
+	/* Empties the table and sizes it for count slots */
+	void reset(size_t count)
+	{
+		size_t cap = 16;
+		while (count * 4 > cap * 3)
+		{
+			cap *= 2;
+		}
+
+		cells_.assign(cap, static_cast< std::uint32_t >(none));
+		size_ = 0;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+private:
+	size_t mask() const
+	{
+		return cells_.size() - 1;
+	}
+
+	void place(std::uint32_t slot, size_t h)
+	{
+		size_t c = h & mask();
+		while (cells_[c] != none)
+		{
+			c = (c + 1) & mask();
+		}
+
+		cells_[c] = slot;
+	}
+
+	template< typename HashOf >
+	void grow(const HashOf& hash_of)
+	{
+		std::vector< std::uint32_t > old;
+		old.swap(cells_);
+		cells_.assign(old.empty() ? 16 : old.size() * 2, static_cast< std::uint32_t >(none));
+		for (auto s : old)
+		{
+			if (s != none)
+			{
+				place(s, hash_of(s));
+			}
+		}
+	}
+
+	std::vector< std::uint32_t > cells_;
+	size_t size_{0};
+};
+
+} // namespace nlab
@@ -1,142 +1,360 @@
 ﻿#include "tweann.h"
+#include "rng.h"
 
+#include <algorithm>
 #include <chrono>
-#include <random>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <thread>
 
 using namespace nlab;
 
+/* One stream per thread, so copies can be made concurrently. g_lab overwrites the ids of the
+ * nets it creates from its own seeded stream. */
 std::uint64_t tweann::generate_id()
 {
-	static std::uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
-	static std::mt19937_64 gen(seed);
-	static std::uniform_int_distribution< std::uint32_t > dist; //borland compiler fails with 
-	//uint64_t distribution
-	return (std::uint64_t(dist(gen)) << 32) | std::uint64_t(dist(gen));
+	thread_local rng gen(std::chrono::system_clock::now().time_since_epoch().count(),
+		std::hash< std::thread::id >()(std::this_thread::get_id()));
+	return gen.next();
 }
 
 /* */
 tweann::tweann(size_t in, size_t out)
 {
-	int maxx = 392;
-	int maxy = 491;
-	int fx = 10;
-	int fy = 10;
-	int r = 20;
-
 	nr.link_rep_ = &lr;
 	lr.neuron_rep_ = &nr;
 	for (size_t i = 0; i < in + out; i++)
 	{
-		neuron* n = nr.get(nr.insert(neuron())); // TODO: try optimize
+		neuron n;
 		if (i < in)
 		{
-			n->c->type = input;
+			n.type = input;
 		}
 		else
 		{
-			n->c->type = output;
+			n.type = output;
 		}
 
-		n->c->e = 0;
-		n->c->ea = 1;
+		n.e = 0;
+		n.ea = 1;
 
-		if (i < in)
+		nr.insert(n);
+	}
+
+	fitness = 0;
+	id = generate_id();
+}
+
+/* */
+neuron_v& tweann::visual(std::uint64_t id)
+{
+	if (!layout_)
+	{
+		layout_ = std::make_shared< neuron_layout >();
+	}
+	else if (layout_.use_count() > 1)
+	{
+		layout_ = std::make_shared< neuron_layout >(*layout_);
+	}
+
+	return (*layout_)[id];
+}
+
+/* Inputs are spread along the top edge and outputs along the bottom one, in slot order, the
+ * way new nets have always been laid out; hidden neurons get a spot derived from their id. */
+neuron_layout tweann::layout() const
+{
+	const int maxx = 392;
+	const int maxy = 491;
+	const int fx = 10;
+	const int fy = 10;
+	const int r = 20;
+
+	unsigned in = 0;
+	unsigned out = 0;
+	for (size_t i = 0; i < nr.size(); i++)
+	{
+		in += nr.alive(i) && nr.types()[i] == input;
+		out += nr.alive(i) && nr.types()[i] == output;
+	}
+
+	neuron_layout res;
+	unsigned in_k = 0;
+	unsigned out_k = 0;
+	for (size_t i = 0; i < nr.size(); i++)
+	{
+		if (!nr.alive(i))
 		{
-			int dx = (maxx - 2 * fx - 2 * r) / (static_cast< unsigned >(in) + 1);
-			n->v->y = 0 + fy + r;
-			n->v->x = 0 + fx + dx * static_cast< unsigned >(i + 1) + r;
-			n->v->r = r;
+			continue;
+		}
+
+		const std::uint64_t id = nr.ids()[i];
+		neuron_v v;
+		if (nr.types()[i] == input)
+		{
+			int dx = (maxx - 2 * fx - 2 * r) / static_cast< int >(in + 1);
+			v.y = fy + r;
+			v.x = fx + dx * static_cast< int >(++in_k) + r;
+			v.r = r;
+		}
+		else if (nr.types()[i] == output)
+		{
+			int dx = (maxx - 2 * fx - 2 * r) / static_cast< int >(out + 1);
+			v.y = maxy - fy - r;
+			v.x = fx + dx * static_cast< int >(++out_k) + r;
+			v.r = r;
 		}
 		else
 		{
-			int dx = (maxx - 2 * fx - 2 * r) / static_cast< unsigned >(out+1);
-			n->v->y = maxy - fy - r;
-			n->v->x = 0 + fx + dx * static_cast< unsigned >(i - in + 1) + r;
-			n->v->r = r;
+			v.x = static_cast< int >((id * 2654435761u) % 400);
+			v.y = static_cast< int >((id * 40503u + 17) % 400);
+		}
+
+		if (layout_)
+		{
+			auto it = layout_->find(id);
+			if (it != layout_->end())
+			{
+				v = it->second;
+			}
 		}
+
+		res[id] = v;
 	}
 
-	fitness = 0;
-	id = generate_id();
+	return res;
 }
 
-/* */
+/* A valid frontier lists every evaluated neuron and link that can hold energy after a tick
+ * (in_e is always empty by then), and the plan lists the ones it skips, so with an unchanged
+ * plan only those need clearing, which pays off while they are a small part of the state.
+ * Either way the frontier then stays valid, empty, so the next tick needs no full scan. */
 int tweann::reset()
 {
-	for (auto& i : nr.neurons)
+	const bool tracked = frontier.valid && plan.is_valid(nr, lr);
+	const size_t listed = frontier.next.size() + frontier.links.size() + plan.skipped.size() +
+		plan.idle_links.size();
+	double* e = nr.e_data();
+	double* in_e = lr.in_e_data();
+	double* out_e = lr.out_e_data();
+	if (tracked && listed * 4 < nr.size() + 2 * lr.size())
+	{
+		for (auto i : frontier.next)
+		{
+			e[i] = 0;
+		}
+
+		for (auto j : frontier.links)
+		{
+			out_e[j] = 0;
+		}
+
+		for (auto i : plan.skipped)
+		{
+			e[i] = 0;
+		}
+
+		for (auto j : plan.idle_links)
+		{
+			in_e[j] = 0;
+			out_e[j] = 0;
+		}
+	}
+	else
 	{
-		i.c->e = 0;
+		std::fill(e, e + nr.size(), 0.0);
+		std::fill(in_e, in_e + lr.size(), 0.0);
+		std::fill(out_e, out_e + lr.size(), 0.0);
 	}
 
-	for (auto& i : lr.links)
+	if (!tracked)
 	{
-		i.in_e = 0;
-		i.out_e = 0;
+		frontier.invalidate();
+		return 0;
 	}
 
+	for (auto i : frontier.next)
+	{
+		frontier.queued[i] = 0;
+	}
+
+	frontier.next.clear();
+	frontier.links.clear();
 	return 0;
 }
 
 /* */
-net_task tweann::calc(const net_task& task)
+void tweann::compact()
 {
-	std::vector< neuron_c * > n_in;
-	std::vector< neuron_c * > n_out;
+	nr.compact();
+	lr.compact();
+}
 
-	n_in.reserve(task.size());
-	size_t sz = nr.neurons.size();
-	for (size_t i = 0; i < sz; i++)
+/* */
+void tweann::update_plan()
+{
+	if (!plan.is_valid(nr, lr) || plan.unobservable_pruned != prune_unobservable)
 	{
-		neuron_c* nc = nr.neurons[i].c;
-		if (nc->type == neuron_type::input)
-		{
-			n_in.push_back(nc);
-			continue;
-		}
+		plan.compile(nr, lr, prune_unobservable);
+		frontier.invalidate();
+	}
+}
 
-		if (nc->type == neuron_type::output)
-		{
-			n_out.push_back(nc);
-		}
+/* */
+net_task tweann::calc(const net_task& task)
+{
+	update_plan();
+	net_task out(plan.outputs.size());
+	calc_into(task.data(), task.size(), out.data(), out.size());
+	return out;
+}
+
+/* */
+net_task tweann::calc_ticks(const net_task& task, size_t k)
+{
+	update_plan();
+	net_task out(plan.outputs.size());
+	calc_ticks_into(task.data(), task.size(), out.data(), out.size(), k, -1);
+	return out;
+}
+
+/* */
+net_task tweann::calc_until_stable(const net_task& task, double eps, size_t max_ticks)
+{
+	update_plan();
+	net_task out(plan.outputs.size());
+	calc_ticks_into(task.data(), task.size(), out.data(), out.size(), max_ticks, eps);
+	return out;
+}
+
+/* */
+void tweann::calc_into(const double* in, size_t n_in, double* out, size_t n_out)
+{
+	calc_ticks_into(in, n_in, out, n_out, 1, -1);
+}
+
+/* out holds the previous tick's outputs while the next one is written, so settling needs
+ * no second buffer. */
+size_t tweann::calc_ticks_into(const double* in, size_t n_in, double* out, size_t n_out,
+	size_t max_ticks, double eps)
+{
+	update_plan();
+
+	if (plan.inputs.size() != n_in)
+	{
+		throw std::runtime_error("Input buffer doesn't match network inputs");
 	}
 
-	if (n_in.size() != task.size())
+	if (plan.outputs.empty())
 	{
-		throw;
+		throw std::runtime_error("Network has no outputs");
 	}
 
-	if (n_out.empty())
+	if (plan.outputs.size() != n_out)
 	{
-		throw;
+		throw std::runtime_error("Output buffer doesn't match network outputs");
 	}
 
-	sz = n_in.size();
-	for (size_t i = 0; i < sz; i++)
+	double* e = nr.e_data();
+	double* in_e = lr.in_e_data();
+	double* out_e = lr.out_e_data();
+	for (size_t t = 0; t < max_ticks; t++)
 	{
-		n_in[i]->e += task[i];
+		for (size_t i = 0; i < n_in; i++)
+		{
+			e[plan.inputs[i]] += in[i];
+		}
+
+		if (event_driven)
+		{
+			plan.run_sparse(nr, frontier, e, in_e, out_e);
+		}
+		else
+		{
+			plan.run(nr, e, in_e, out_e);
+			frontier.invalidate();
+		}
+
+		bool stable = true;
+		for (size_t i = 0; i < n_out; i++)
+		{
+			double& eo = e[plan.outputs[i]];
+			stable = stable && !(std::fabs(eo - out[i]) > eps);
+			out[i] = eo;
+			eo = 0;
+		}
+
+		if (eps >= 0 && t > 0 && stable)
+		{
+			return t + 1;
+		}
 	}
 
-	sz = nr.neurons.size();
-	for (size_t i = 0; i < sz; i++)
+	return max_ticks;
+}
+
+/* */
+template< typename T >
+void tweann::calc_batch(basic_batch_state< T >& st, const T* in, T* out)
+{
+	update_plan();
+
+	const size_t n_count = plan.neuron_count;
+	const size_t l_count = plan.link_count;
+	if (st.e.size() != st.count * n_count || st.in_e.size() != st.count * l_count)
 	{
-		nr.neurons[i].c->calc();
+		throw std::runtime_error("Batch state doesn't match network, reset it first");
 	}
 
-	sz = lr.links.size();
-	for (size_t j = 0; j < sz; j++)
+	if (plan.outputs.empty())
 	{
-		lr.links[j].calc();
+		throw std::runtime_error("Network has no outputs");
 	}
 
-	net_task out;
-	sz = n_out.size();
-	out.reserve(sz);
-	for (size_t i = 0; i < sz; i++)
+	const size_t n_in = plan.inputs.size();
+	const size_t n_out = plan.outputs.size();
+	for (size_t k = 0; k < st.count; k++)
 	{
-		out.push_back(n_out[i]->e);
-		n_out[i]->e = 0;
+		T* e = st.e.data() + k * n_count;
+		const T* task = in + k * n_in;
+		for (size_t i = 0; i < n_in; i++)
+		{
+			e[plan.inputs[i]] += task[i];
+		}
+
+		plan.run(nr, e, st.in_e.data() + k * l_count, st.out_e.data() + k * l_count);
+
+		T* res = out + k * n_out;
+		for (size_t i = 0; i < n_out; i++)
+		{
+			res[i] = e[plan.outputs[i]];
+			e[plan.outputs[i]] = 0;
+		}
 	}
+}
 
-	return out;
+template void nlab::tweann::calc_batch< double >(basic_batch_state< double >&, const double*,
+	double*);
+template void nlab::tweann::calc_batch< float >(basic_batch_state< float >&, const float*,
+	float*);
+
+/* */
+template< typename T >
+void basic_batch_state< T >::reset(const tweann& nt, size_t k)
+{
+	count = k;
+	e.resize(k * nt.nr.size());
+	in_e.resize(k * nt.lr.size());
+	out_e.resize(k * nt.lr.size());
+
+	for (size_t i = 0; i < k; i++)
+	{
+		std::copy(nt.nr.e().begin(), nt.nr.e().end(), e.begin() + i * nt.nr.size());
+		std::copy(nt.lr.in_e().begin(), nt.lr.in_e().end(), in_e.begin() + i * nt.lr.size());
+		std::copy(nt.lr.out_e().begin(), nt.lr.out_e().end(), out_e.begin() + i * nt.lr.size());
+	}
 }
 
+template class nlab::basic_batch_state< double >;
+template class nlab::basic_batch_state< float >;
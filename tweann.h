@@ -1,34 +1,103 @@
 ﻿#pragma once
 
 #include "neuron.h"
+#include "eval_plan.h"
 
 #include <string>
 #include <cstdint>
+#include <memory>
+#include <unordered_map>
 
 namespace nlab {
 
 using net_task = std::vector< double >;
 
+// neuron positions for the editor, keyed by neuron id
+using neuron_layout = std::unordered_map< std::uint64_t, neuron_v >;
+
+template< typename T >
+class basic_batch_state;
+
+using batch_state = basic_batch_state< double >;
+
 class tweann
 {
 public:
+	/* Puts the state back to rest, eagerly. After event-driven ticks with little activity only
+	 * the frontier and the slots the plan prunes are cleared, and the frontier stays valid. */
 	int reset();
+
 	net_task calc(const net_task& task);
 
+	/* calc without allocations: in holds n_in values, out receives n_out values, both must
+	 * match the network's input/output counts. */
+	void calc_into(const double* in, size_t n_in, double* out, size_t n_out);
+
+	/* Run k ticks against the same input and return the outputs of the last one, so a
+	 * signal can cross up to k links per call. calc_ticks(in, 1) is calc(in). */
+	net_task calc_ticks(const net_task& task, size_t k);
+
+	/* Like calc_ticks, but stops as soon as no output moves by more than eps between two
+	 * ticks, after at most max_ticks ticks. */
+	net_task calc_until_stable(const net_task& task, double eps, size_t max_ticks);
+
+	/* Buffer form of both: runs up to max_ticks ticks, settling as in calc_until_stable
+	 * unless eps < 0. Returns the number of ticks run. */
+	size_t calc_ticks_into(const double* in, size_t n_in, double* out, size_t n_out,
+		size_t max_ticks, double eps);
+
+	/* Recompiles the plan if the genome changed since the last compile */
+	void update_plan();
+
+	/* Drops slots left dead by deletions, see neuron_rep/link_rep */
+	void compact();
+
+	/* Advances every copy in st by one tick. in is a row-major st.count x inputs matrix,
+	 * out receives st.count x outputs. Nothing is allocated.
+	 * Instantiated for double and float; float runs the same plan in single precision. */
+	template< typename T >
+	void calc_batch(basic_batch_state< T >& st, const T* in, T* out);
+
+	/* Stored position of neuron id, the layout is created by the first call. Nothing else
+	 * touches it, so headless nets never carry one; copies share it until one of them
+	 * writes. */
+	neuron_v& visual(std::uint64_t id);
+
+	/* Positions of all live neurons: the stored ones, defaults for the rest */
+	neuron_layout layout() const;
+
+	bool has_layout() const
+	{
+		return layout_ != nullptr;
+	}
+
 	tweann() : tweann(3, 1) { }
 
 	tweann(size_t in, size_t out);
 
 	neuron_rep nr;
 	link_rep lr;
+	eval_plan plan;
+	eval_frontier frontier; // state of the event-driven mode, see eval_plan::run_sparse
+	// evaluate with eval_plan::run_sparse: same results, but quiescent neurons and links cost
+	// nothing, which pays off when few neurons are active per tick
+	bool event_driven{false};
+	// also leave structure that can't reach an output out of the plan (see eval_plan::prune);
+	// it stops evolving until it is reconnected, so set it only when the net is reset after
+	// every mutation
+	bool prune_unobservable{false};
 	double fitness;
 	std::uint64_t id;
 
 	std::wstring note;
 	std::wstring name;
 
-	tweann(const tweann& n) : nr(n.nr), lr(n.lr), fitness(n.fitness), id(generate_id()),
-		note(n.note), name(n.name)
+	/* Copies share the genome blocks of n (see neuron_rep) until either side mutates them.
+	 * The plan isn't copied: offspring are mutated right away, so it is rebuilt by the
+	 * first calc. */
+	tweann(const tweann& n) : nr(n.nr), lr(n.lr), event_driven(n.event_driven),
+		prune_unobservable(n.prune_unobservable), fitness(n.fitness), id(generate_id()),
+		note(n.note), name(n.name), layout_(n.layout_)
 	{
 		nr.link_rep_ = &lr;
 		lr.neuron_rep_ = &nr;
@@ -42,18 +111,40 @@ public:
 
 		nr = n.nr;
 		lr = n.lr;
+		plan = eval_plan();
+		frontier.invalidate();
+		event_driven = n.event_driven;
+		prune_unobservable = n.prune_unobservable;
 		nr.link_rep_ = &lr;
 		lr.neuron_rep_ = &nr;
 		fitness = n.fitness;
 		id = generate_id();
 		note = n.note;
 		name = n.name;
+		layout_ = n.layout_;
 
 		return *this;
 	}
 
 private:
 	static std::uint64_t generate_id();
+
+	std::shared_ptr< neuron_layout > layout_;
+};
+
+/* count independent copies of one network's runtime state for tweann::calc_batch.
+ * Each copy is stored contiguously: e is count x neurons, in_e/out_e are count x links.
+ * reset() converts the genome's state to T. */
+template< typename T >
+class basic_batch_state
+{
+public:
+	void reset(const tweann& nt, size_t k);
+
+	size_t count{0};
+	std::vector< T > e;
+	std::vector< T > in_e;
+	std::vector< T > out_e;
 };
 
 } // namespace nlab
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "worker_pool.h"
+
+using namespace nlab;
+
+/* Workers are idle whenever no run() is in progress, so they only have to be woken */
+worker_pool::~worker_pool()
+{
+	{
+		std::lock_guard< std::mutex > guard(lock_);
+		quit_ = true;
+	}
+
+	ready_.notify_all();
+	for (auto& t : workers_)
+	{
+		t.join();
+	}
+}
+
+/* Every job gets a thread, so jobs that wait on each other or on something outside (an
+ * environment) can't starve. Jobs no worker has picked up by the time the caller is done
+ * with its own are run by the caller. */
+void worker_pool::run(const std::vector< std::function< void() > >& jobs)
+{
+	if (jobs.empty())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard< std::mutex > guard(lock_);
+		while (workers_.size() + 1 < jobs.size())
+		{
+			workers_.emplace_back(&worker_pool::work, this);
+		}
+
+		queue_.insert(queue_.end(), jobs.begin() + 1, jobs.end());
+		unfinished_ += jobs.size() - 1;
+	}
+
+	ready_.notify_all();
+	jobs.front()();
+
+	std::unique_lock< std::mutex > guard(lock_);
+	while (!queue_.empty())
+	{
+		std::function< void() > job = std::move(queue_.front());
+		queue_.pop_front();
+		guard.unlock();
+		job();
+		guard.lock();
+		finish_one();
+	}
+
+	while (unfinished_ != 0)
+	{
+		done_.wait(guard);
+	}
+}
+
+/* Thread body */
+void worker_pool::work()
+{
+	std::unique_lock< std::mutex > guard(lock_);
+	for (;;)
+	{
+		while (!quit_ && queue_.empty())
+		{
+			ready_.wait(guard);
+		}
+
+		if (quit_)
+		{
+			return;
+		}
+
+		std::function< void() > job = std::move(queue_.front());
+		queue_.pop_front();
+		guard.unlock();
+		job();
+		guard.lock();
+		finish_one();
+	}
+}
+
+/* Called with lock_ held */
+void worker_pool::finish_one()
+{
+	if (--unfinished_ == 0)
+	{
+		done_.notify_all();
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nlab {
+
+using std::size_t;
+
+/* Threads kept across calls, so work handed out every generation doesn't start and join
+ * threads each time. run() gives a batch of jobs to the workers and takes part itself; the
+ * pool grows to the largest batch seen and its threads wait on a condition variable in
+ * between. Jobs must not throw, the callers collect errors themselves (see
+ * g_lab::breed_worker, g_lab::run_env). One run() at a time. */
+class worker_pool
+{
+public:
+	worker_pool() = default;
+	worker_pool(const worker_pool&) = delete;
+	worker_pool& operator=(const worker_pool&) = delete;
+	~worker_pool();
+
+	/* Runs every job, all of them at once, and returns when they are done. The first one runs
+	 * on the calling thread. */
+	void run(const std::vector< std::function< void() > >& jobs);
+
+	size_t size() const
+	{
+		return workers_.size();
+	}
+
+private:
+	void work();
+	void finish_one();
+
+	std::vector< std::thread > workers_;
+	std::deque< std::function< void() > > queue_;
+	size_t unfinished_{0};
+	bool quit_{false};
+	std::mutex lock_;
+	std::condition_variable ready_; // a job was queued or the pool is closing
+	std::condition_variable done_; // unfinished_ dropped to 0
+};
+
+} // namespace nlab